@@ -1,4 +1,5 @@
 #include <arch/cpu.h>
+#include <config.h>
 #include <dummyos/compiler.h>
 #include <kernel/cpu.h>
 #include <kernel/types.h>
@@ -45,6 +46,57 @@ struct cpu_info* cpu_info(void)
 	return &arm_cpu_info;
 }
 
+#if RPI_MODEL <= 1
+/* ARM1176: cycle counter of the system validation registers */
+static void enable_cycle_counter(void)
+{
+	uint32_t pmnc;
+
+	__asm__ volatile ("mrc p15, #0, %0, c15, c12, #0" : "=r" (pmnc));
+	__asm__ volatile ("mcr p15, #0, %0, c15, c12, #0" : : "r" (pmnc | 1));
+}
+
+static inline uint32_t read_cycle_counter(void)
+{
+	uint32_t ccnt;
+
+	__asm__ volatile ("mrc p15, #0, %0, c15, c12, #1" : "=r" (ccnt));
+
+	return ccnt;
+}
+#else
+/* ARMv7: PMCCNTR of the performance monitors extension */
+static void enable_cycle_counter(void)
+{
+	uint32_t pmcr;
+
+	__asm__ volatile ("mrc p15, #0, %0, c9, c12, #0" : "=r" (pmcr));
+	__asm__ volatile ("mcr p15, #0, %0, c9, c12, #0" : : "r" (pmcr | 1));
+	__asm__ volatile ("mcr p15, #0, %0, c9, c12, #1" : : "r" (1u << 31));
+}
+
+static inline uint32_t read_cycle_counter(void)
+{
+	uint32_t ccnt;
+
+	__asm__ volatile ("mrc p15, #0, %0, c9, c13, #0" : "=r" (ccnt));
+
+	return ccnt;
+}
+#endif
+
+uint32_t cpu_cycles(void)
+{
+	static bool enabled = false;
+
+	if (!enabled) {
+		enable_cycle_counter();
+		enabled = true;
+	}
+
+	return read_cycle_counter();
+}
+
 struct A7_multiprocessor_affinity_register
 {
 	uint32_t cpuid:2;
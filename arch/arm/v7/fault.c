@@ -17,12 +17,15 @@ void data_abort_handler(struct cpu_context* ctx)
 
 	log_w_printf("pc=%p, dfsr=%p\n", (void*)fault_addr, (void*)dfsr);
 
+	// long-descriptor format status: 0b0001LL is a translation fault
+	if ((dfsr & 0x3c) == 0x04)
+		flags |= VMM_FAULT_NOT_PRESENT;
 	if (dfsr & (1 << 11))
 		flags |= VMM_FAULT_WRITE;
 	if (cpu_context_is_usermode(ctx))
 		flags |= VMM_FAULT_USER;
 
-	fixup_ret = vmm_handle_page_fault(fault_addr, flags);
+	fixup_ret = vmm_handle_page_fault(fault_addr, ctx->pc, flags);
 	if (fixup_ret)
 		ctx->pc = fixup_ret;
 }
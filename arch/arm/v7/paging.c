@@ -1,4 +1,5 @@
 #include <dummyos/errno.h>
+#include <kernel/interrupt.h>
 #include <kernel/kassert.h>
 #include <kernel/kernel_image.h>
 #include <kernel/mm/vmm.h>
@@ -72,6 +73,41 @@ static inline void invalidate_tlb_entry(v_addr_t addr)
 	__asm__ volatile ("mcr p15, #0, %0, c8, c7, #3" : : "r" (addr) : "memory");
 }
 
+static inline void flush_tlb(void)
+{
+	// TLBIALL (invalidate entire unified TLB)
+	__asm__ volatile ("mcr p15, #0, %0, c8, c7, #0" : : "r" (0) : "memory");
+}
+
+/*
+ * The user pages are not global and all use ASID 0: the kernel pages (global)
+ * stay in the TLB.
+ */
+static inline void flush_user_tlb(void)
+{
+	// TLBIASID (invalidate unified TLB by ASID)
+	__asm__ volatile ("mcr p15, #0, %0, c8, c7, #2" : : "r" (0) : "memory");
+}
+
+/*
+ * User pages may be invalidated at the end of a batch (see vmm_tlb_batch_*).
+ */
+static inline void invalidate_user_tlb_entry(v_addr_t addr)
+{
+	if (!vmm_tlb_batch_defer(addr))
+		invalidate_tlb_entry(addr);
+}
+
+void paging_invalidate_tlb_entry(v_addr_t vaddr)
+{
+	invalidate_tlb_entry(vaddr);
+}
+
+void paging_flush_user_tlb(void)
+{
+	flush_user_tlb();
+}
+
 #define TTBR1_RECURSIVE_LV2_ENTRY (LV2_ENTRIES - 2) // high exception vectors need the last entry
 #define TTBR1_LV2_FREE_ENTRIES_END (LV2_ENTRIES - 3)
 
@@ -173,37 +209,124 @@ static int unmap_page(void* page)
 	return 0;
 }
 
-p_addr_t paging_virt_to_phys(v_addr_t vaddr)
+int paging_kernel_virt_to_phys(v_addr_t vaddr, p_addr_t* paddr)
 {
-	kassert(!vmm_is_userspace_address(vaddr));
-
 	const size_t lv2_idx = vaddr2lv2_index(vaddr);
 	const size_t lv3_idx = vaddr2lv3_index(vaddr);
 	const uint64_t* lv3_table = get_ttbr1_lv3(lv2_idx);
 
-	kassert(valid_descriptor(ttbr1_lv2[lv2_idx]) &&
-		valid_descriptor(lv3_table[lv3_idx]));
+	if (!valid_descriptor(ttbr1_lv2[lv2_idx]) ||
+	    !valid_descriptor(lv3_table[lv3_idx]))
+		return -EFAULT;
+
+	*paddr = descriptor_address(lv3_table[lv3_idx]) | (vaddr & 0xfff);
+
+	return 0;
+}
+
+p_addr_t paging_virt_to_phys(v_addr_t vaddr)
+{
+	p_addr_t paddr;
+
+	kassert(!vmm_is_userspace_address(vaddr));
+	kassert(paging_kernel_virt_to_phys(vaddr, &paddr) == 0);
 
-	return descriptor_address(lv3_table[lv3_idx]) | (vaddr & 0xfff);
+	return paddr;
 }
 
 void paging_switch_ttbr0(p_addr_t ttbr0)
 {
+	// the boot identity mapping is global
+	static bool boot_ttbr0 = true;
+
 	log_printf("Switching ttbr0 (%p)!\n", (void*)ttbr0);
 	__asm__ volatile ("mcr p15, #0, %0, c2, c0, #0" : : "r" (ttbr0) : "memory");
 
-	// TLBIALL (invalidate entire unified TLB)
-	__asm__ volatile ("mcr p15, #0, %0, c8, c7, #0" : : "r" (0) : "memory");
+	if (boot_ttbr0) {
+		flush_tlb();
+		boot_ttbr0 = false;
+	}
+	else {
+		flush_user_tlb();
+	}
 }
 
 
+/*
+ * After fork, the lv3 tables are shared read-only by the parent and the
+ * child: the lv2 descriptors have APTABLE_RO set, and the lv3 table frame
+ * holds a reference per lv2 table.
+ */
+static inline bool lv3_table_is_shared(uint64_t lv2_desc)
+{
+	return (valid_descriptor(lv2_desc) && (lv2_desc & APTABLE_RO));
+}
+
+/*
+ * Gives the lv2 table its own copy of the shared lv3 table lv2_desc points
+ * to, before one of its entries is modified. Pages whose frame is still
+ * shared copy-on-write are read-only in the copy.
+ */
+static int unshare_lv3_table(uint64_t* lv2_desc)
+{
+	const p_addr_t shared = descriptor_address(*lv2_desc);
+	p_addr_t lv3_frame = shared;
+	uint64_t* lv3_table;
+
+	// the other lv2 tables may have unshared it already
+	if (memory_page_frame_get_ref(shared) > 1) {
+		uint64_t* src;
+		int err = -ENOMEM;
+
+		lv3_frame = memory_page_frame_alloc();
+		if (!lv3_frame)
+			return -ENOMEM;
+
+		src = map_page(shared);
+		if (src) {
+			err = paging_copy_page((v_addr_t)src, lv3_frame);
+			unmap_page(src);
+		}
+		if (err) {
+			memory_page_frame_free(lv3_frame);
+			return err;
+		}
+	}
+
+	lv3_table = map_page(lv3_frame);
+	if (!lv3_table) {
+		if (lv3_frame != shared)
+			memory_page_frame_free(lv3_frame);
+		return -ENOMEM;
+	}
+
+	for (size_t i = 0; i < LV3_ENTRIES; ++i) {
+		if (valid_descriptor(lv3_table[i]) &&
+		    memory_page_frame_get_ref(descriptor_address(lv3_table[i])) > 1)
+			lv3_descriptor_set_ro(&lv3_table[i]);
+	}
+
+	unmap_page(lv3_table);
+
+	*lv2_desc = make_lv2_descriptor(lv3_frame);
+	if (lv3_frame != shared) {
+		memory_page_table_set_entries(lv3_frame,
+					      memory_page_table_get_entries(shared));
+		memory_page_frame_unref(shared);
+	}
+
+	flush_user_tlb();
+
+	return 0;
+}
+
 int paging_clone_current_cow(uint64_t* dst_lv1, uint64_t* src_lv1)
 {
 	for (size_t lv1_idx = 0; lv1_idx < LV1_ENTRIES; ++lv1_idx) {
 		if (!valid_descriptor(src_lv1[lv1_idx]))
 			continue;
 
-		p_addr_t lv2_frame = memory_page_frame_alloc();
+		p_addr_t lv2_frame = memory_page_frame_alloc_zeroed();
 		if (!lv2_frame)
 			return -ENOMEM;
 		uint64_t* dst_lv2_table = map_page(lv2_frame);
@@ -211,7 +334,6 @@ int paging_clone_current_cow(uint64_t* dst_lv1, uint64_t* src_lv1)
 			memory_page_frame_free(lv2_frame);
 			return -ENOMEM;
 		}
-		memset(dst_lv2_table, 0, PAGE_SIZE);
 		dst_lv1[lv1_idx] = make_lv1_descriptor((p_addr_t)lv2_frame);
 		uint64_t* src_lv2_table = map_page(descriptor_address(src_lv1[lv1_idx]));
 		if (!src_lv2_table) {
@@ -219,57 +341,47 @@ int paging_clone_current_cow(uint64_t* dst_lv1, uint64_t* src_lv1)
 			return -ENOMEM;
 		}
 
+		// the lv3 tables are shared, each is copied on its first modification
 		for (size_t lv2_idx = 0; lv2_idx < LV2_ENTRIES; ++lv2_idx) {
 			if (!valid_descriptor(src_lv2_table[lv2_idx]))
 				continue;
 
-			p_addr_t lv3_frame = memory_page_frame_alloc();
-			if (!lv3_frame)
-				return -ENOMEM;
-			uint64_t* dst_lv3_table = map_page(lv3_frame);
-			if (!dst_lv3_table) {
-				memory_page_frame_free(lv3_frame);
-				return -ENOMEM;
-			}
-			memset(dst_lv3_table, 0, PAGE_SIZE);
-			dst_lv2_table[lv2_idx] = make_lv2_descriptor((p_addr_t)lv3_frame);
-			uint64_t* src_lv3_table = map_page(descriptor_address(src_lv2_table[lv2_idx]));
-			if (!src_lv3_table) {
-				unmap_page(dst_lv3_table);
-				return -ENOMEM;
-			}
-
-			for (size_t lv3_idx = 0; lv3_idx < LV3_ENTRIES; ++lv3_idx) {
-				if (!valid_descriptor(src_lv3_table[lv3_idx]))
-					continue;
-
-				lv3_descriptor_set_ro(&src_lv3_table[lv3_idx]);
-				dst_lv3_table[lv3_idx] = src_lv3_table[lv3_idx];
+			memory_page_frame_ref(descriptor_address(src_lv2_table[lv2_idx]));
 
-				invalidate_tlb_entry(ttbr0_lv1_2_3_idx2_vaddr(lv1_idx, lv2_idx, lv3_idx));
-			}
+			src_lv2_table[lv2_idx] |= APTABLE_RO;
+			dst_lv2_table[lv2_idx] = src_lv2_table[lv2_idx];
 		}
+
+		unmap_page(src_lv2_table);
+		unmap_page(dst_lv2_table);
 	}
 
+	// the parent lost write access to its whole user space
+	flush_user_tlb();
+
 	return 0;
 }
 
+/*
+ * Frees the lv2 tables, and drops the references on the lv3 tables: those may
+ * still be shared since fork.
+ */
 static int clear_user_lv_table(uint64_t* table, size_t lv)
 {
 	const size_t entries[] = {
 		0,
 		LV1_ENTRIES,
 		LV2_ENTRIES,
-		LV3_ENTRIES,
 	};
 	int err = 0;
 
-	kassert(lv >= 1 && lv <= 3);
+	kassert(lv >= 1 && lv <= 2);
 
 	for (size_t i = 0; i < entries[lv]; ++i) {
 		if (valid_descriptor(table[i])) {
-			if (lv < 3) {
-				p_addr_t sub_frame = descriptor_address(table[i]);
+			p_addr_t sub_frame = descriptor_address(table[i]);
+
+			if (lv < 2) {
 				uint64_t* sub_table = map_page(sub_frame);
 				if (!sub_table) {
 					err = -ENOMEM;
@@ -278,11 +390,10 @@ static int clear_user_lv_table(uint64_t* table, size_t lv)
 
 				clear_user_lv_table(sub_table, lv + 1);
 				unmap_page(sub_table);
-				memory_page_frame_free(sub_frame);
-			}
-			else {
-				table[i] = 0;
 			}
+
+			memory_page_frame_unref(sub_frame);
+			table[i] = 0;
 		}
 	}
 
@@ -308,6 +419,27 @@ int paging_copy_page(v_addr_t src_page, p_addr_t dst_frame)
 	return 0;
 }
 
+int paging_zero_page(p_addr_t frame)
+{
+	void* page;
+	int err = 0;
+
+	irq_disable();
+
+	page = map_page(frame);
+	if (page) {
+		memset(page, 0, PAGE_SIZE);
+		unmap_page(page);
+	}
+	else {
+		err = -ENOMEM;
+	}
+
+	irq_enable();
+
+	return err;
+}
+
 int paging_update_kernel_prot(v_addr_t vaddr, int prot)
 {
 	size_t lv2_idx = vaddr2lv2_index(vaddr);
@@ -341,6 +473,11 @@ int paging_update_user_prot(v_addr_t vaddr, int prot, uint64_t* lv1_table)
 		err = -EINVAL;
 		goto unmap_lv2_table;
 	}
+	if (lv3_table_is_shared(lv2_table[lv2_idx])) {
+		err = unshare_lv3_table(&lv2_table[lv2_idx]);
+		if (err)
+			goto unmap_lv2_table;
+	}
 
 	uint64_t* lv3_table = map_page(descriptor_address(lv2_table[lv2_idx]));
 	if (!lv3_table) {
@@ -353,7 +490,8 @@ int paging_update_user_prot(v_addr_t vaddr, int prot, uint64_t* lv1_table)
 	}
 
 	lv3_descriptor_update_prot(&lv3_table[lv3_idx], prot);
-	invalidate_tlb_entry(vaddr);
+	lv3_table[lv3_idx] |= NG;
+	invalidate_user_tlb_entry(vaddr);
 
 unmap_lv3_table:
 	unmap_page(lv3_table);
@@ -374,14 +512,12 @@ int paging_kernel_map(p_addr_t paddr, v_addr_t vaddr, int prot)
 			return -EADDRINUSE;
 	}
 	else {
-		p_addr_t lv3_frame = memory_page_frame_alloc();
+		p_addr_t lv3_frame = memory_page_frame_alloc_zeroed();
 		if (!lv3_frame)
 			return -ENOMEM;
 
 		ttbr1_lv2[lv2_idx] = make_lv2_descriptor(lv3_frame);
 		invalidate_tlb_entry((v_addr_t)lv3_table);
-
-		memset(lv3_table, 0, PAGE_SIZE);
 	}
 
 	lv3_table[lv3_idx] = make_lv3_descriptor(paddr, prot);
@@ -403,7 +539,7 @@ int paging_user_map(p_addr_t paddr, v_addr_t vaddr, int prot, uint64_t* lv1_tabl
 		lv2_frame = descriptor_address(lv1_table[lv1_idx]);
 	}
 	else {
-		lv2_frame = memory_page_frame_alloc();
+		lv2_frame = memory_page_frame_alloc_zeroed();
 		if (!lv2_frame)
 			return -ENOMEM;
 		lv1_table[lv1_idx] = make_lv1_descriptor(lv2_frame);
@@ -412,34 +548,41 @@ int paging_user_map(p_addr_t paddr, v_addr_t vaddr, int prot, uint64_t* lv1_tabl
 	uint64_t* lv2_table = map_page(lv2_frame);
 	if (!lv2_table)
 		goto clear_lv1_entry;
-	if (!valid_lv1_entry)
-		memset(lv2_table, 0, PAGE_SIZE);
 
 	p_addr_t lv3_frame = 0;
 	bool valid_lv2_entry = valid_descriptor(lv2_table[lv2_idx]);
 	if (valid_lv2_entry) {
+		if (lv3_table_is_shared(lv2_table[lv2_idx])) {
+			int ret = unshare_lv3_table(&lv2_table[lv2_idx]);
+			if (ret) {
+				err = ret;
+				goto unmap_lv2_table;
+			}
+		}
+
 		lv3_frame = descriptor_address(lv2_table[lv2_idx]);
 	}
 	else {
-		lv3_frame = memory_page_frame_alloc();
+		lv3_frame = memory_page_frame_alloc_zeroed();
 		if (!lv3_frame)
 			goto unmap_lv2_table;
+		memory_page_table_set_entries(lv3_frame, 0);
 		lv2_table[lv2_idx] = make_lv2_descriptor(lv3_frame);
 	}
 
 	uint64_t* lv3_table = map_page(lv3_frame);
 	if (!lv3_table)
 		goto clear_lv2_entry;
-	if (!valid_lv2_entry)
-		memset(lv3_table, 0, PAGE_SIZE);
 
 	if (valid_descriptor(lv3_table[lv3_idx])) {
 		err = -EADDRINUSE;
 		goto unmap_lv3_table;
 	}
 
-	lv3_table[lv3_idx] = make_lv3_descriptor(paddr, prot);
+	lv3_table[lv3_idx] = make_lv3_descriptor(paddr, prot) | NG;
+	// an invalidation of vaddr may still be pending in a batch
 	invalidate_tlb_entry(vaddr);
+	memory_page_table_add_entries(lv3_frame, 1);
 
 	unmap_page(lv3_table);
 	unmap_page(lv2_table);
@@ -497,8 +640,14 @@ int paging_user_unmap(v_addr_t vaddr, uint64_t* lv1_table)
 		goto unmap_lv2_table;
 		err = -EINVAL;
 	}
+	if (lv3_table_is_shared(lv2_table[lv2_idx])) {
+		err = unshare_lv3_table(&lv2_table[lv2_idx]);
+		if (err)
+			goto unmap_lv2_table;
+	}
 
-	uint64_t* lv3_table = map_page(descriptor_address(lv2_table[lv2_idx]));
+	const p_addr_t lv3_frame = descriptor_address(lv2_table[lv2_idx]);
+	uint64_t* lv3_table = map_page(lv3_frame);
 	if (!lv3_table) {
 		err = -ENOMEM;
 		goto unmap_lv2_table;
@@ -509,7 +658,19 @@ int paging_user_unmap(v_addr_t vaddr, uint64_t* lv1_table)
 	}
 
 	lv3_table[lv3_idx] = 0;
-	invalidate_tlb_entry(vaddr);
+
+	// the lv3 table is freed with its last entry
+	if (memory_page_table_add_entries(lv3_frame, -1) == 0) {
+		lv2_table[lv2_idx] = 0;
+		// also drops the walk cache entries for vaddr
+		invalidate_tlb_entry(vaddr);
+
+		unmap_page(lv3_table);
+		memory_page_frame_unref(lv3_frame);
+		goto unmap_lv2_table;
+	}
+
+	invalidate_user_tlb_entry(vaddr);
 
 unmap_lv3_table:
 	unmap_page(lv3_table);
@@ -518,3 +679,40 @@ unmap_lv2_table:
 
 	return err;
 }
+
+int paging_user_virt_to_phys(v_addr_t vaddr, p_addr_t* paddr,
+			     uint64_t* lv1_table)
+{
+	size_t lv1_idx = vaddr2lv1_index(vaddr);
+	size_t lv2_idx = vaddr2lv2_index(vaddr);
+	size_t lv3_idx = vaddr2lv3_index(vaddr);
+	int err = 0;
+
+	if (!valid_descriptor(lv1_table[lv1_idx]))
+		return -EFAULT;
+
+	uint64_t* lv2_table = map_page(descriptor_address(lv1_table[lv1_idx]));
+	if (!lv2_table)
+		return -ENOMEM;
+	if (!valid_descriptor(lv2_table[lv2_idx])) {
+		err = -EFAULT;
+		goto unmap_lv2_table;
+	}
+
+	uint64_t* lv3_table = map_page(descriptor_address(lv2_table[lv2_idx]));
+	if (!lv3_table) {
+		err = -ENOMEM;
+		goto unmap_lv2_table;
+	}
+
+	if (valid_descriptor(lv3_table[lv3_idx]))
+		*paddr = descriptor_address(lv3_table[lv3_idx]) | (vaddr & 0xfff);
+	else
+		err = -EFAULT;
+
+	unmap_page(lv3_table);
+unmap_lv2_table:
+	unmap_page(lv2_table);
+
+	return err;
+}
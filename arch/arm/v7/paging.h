@@ -12,12 +12,17 @@
 // memory attributes
 #define AF		(1 << 10) // access flag
 
+#define NG		(1 << 11) // not global: tagged with the ASID
+
 // access permissions [7:6]
 #define AP_KERNEL	(0 << 6)
 #define AP_USER		(1 << 6)
 #define AP_RW		(0 << 7)
 #define AP_RO		(1 << 7)
 
+// table descriptors: no write access to the pages below (APTable[1])
+#define APTABLE_RO	(1ULL << 62)
+
 // attributes index
 #define ATTR_MEM	(0 << 2)
 #define ATTR_DEV	(1 << 2)
@@ -37,6 +42,8 @@ int paging_clear_userspace(uint64_t* lv1_table);
 
 int paging_copy_page(v_addr_t src_page, p_addr_t dst_frame);
 
+int paging_zero_page(p_addr_t frame);
+
 int paging_update_kernel_prot(v_addr_t page, int prot);
 
 int paging_kernel_map(p_addr_t paddr, v_addr_t vaddr, int prot);
@@ -49,6 +56,18 @@ int paging_user_map(p_addr_t paddr, v_addr_t vaddr, int prot, uint64_t* ttbr0);
 
 int paging_user_unmap(v_addr_t vaddr, uint64_t* ttbr0);
 
+int paging_kernel_virt_to_phys(v_addr_t vaddr, p_addr_t* paddr);
+
+int paging_user_virt_to_phys(v_addr_t vaddr, p_addr_t* paddr, uint64_t* ttbr0);
+
+void paging_invalidate_tlb_entry(v_addr_t vaddr);
+
+/**
+ * @brief Flushes the TLB entries of the user pages, the kernel ones are
+ * global
+ */
+void paging_flush_user_tlb(void);
+
 #endif // !ASSEMBLY
 
 #endif
@@ -84,11 +84,6 @@ static int clone_current(struct vmm* clone)
 	return paging_clone_current_cow(v7clone->ttbr0, v7vmm->ttbr0);
 }
 
-static int sync_kernel_space(struct vmm* vmm, void* data)
-{
-	return 0;
-}
-
 static int update_user_prot(v_addr_t virt, int prot)
 {
 	struct vmm* vmm = vmm_get_current_vmm();
@@ -113,20 +108,35 @@ static int unmap_user_page(v_addr_t virt)
 	return paging_user_unmap(virt, v7vmm->ttbr0);
 }
 
+static int virt_to_phys(v_addr_t virt, p_addr_t* phys)
+{
+	if (!vmm_is_userspace_address(virt))
+		return paging_kernel_virt_to_phys(virt, phys);
+
+	struct vmm* vmm = vmm_get_current_vmm();
+	const struct armv7_vmm* v7vmm = get_armv7_vmm(vmm);
+
+	return paging_user_virt_to_phys(virt, phys, v7vmm->ttbr0);
+}
+
 static const struct vmm_interface impl = {
 	.create			= create,
 	.destroy		= destroy,
 	.switch_to		= switch_to,
 	.clone_current		= clone_current,
-	.sync_kernel_space	= sync_kernel_space,
 
 	.copy_page		= paging_copy_page,
+	.zero_page		= paging_zero_page,
 	.update_kernel_page_prot	= paging_update_kernel_prot,
 	.map_kernel_page		= paging_kernel_map,
 	.unmap_kernel_page		= paging_kernel_unmap,
 	.update_user_page_prot		= update_user_prot,
 	.map_user_page			= map_user_page,
 	.unmap_user_page		= unmap_user_page,
+	.virt_to_phys			= virt_to_phys,
+
+	.invalidate_tlb_page		= paging_invalidate_tlb_entry,
+	.flush_user_tlb			= paging_flush_user_tlb,
 };
 
 int arm_vmm_register(void)
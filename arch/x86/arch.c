@@ -106,6 +106,7 @@ static int arch_mm_init()
 	kassert(mem_size_bytes > 0);
 
 	paging_init();
+	paging_physmap_init(mem_size_bytes);
 
 	__memory_early_init();
 
@@ -116,6 +117,9 @@ static int arch_mm_init()
 
 	memory_init(mem_size_bytes, mem_layout, ARRAY_SIZE(mem_layout));
 
+	if (paging_kernel_page_tables_init() != 0)
+		PANIC("Not enough memory for the kernel page tables!");
+
 	return 0;
 }
 
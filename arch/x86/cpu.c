@@ -18,3 +18,12 @@ struct cpu_info* cpu_info(void)
 
 	return &x86_cpu_info;
 }
+
+uint32_t cpu_cycles(void)
+{
+	uint32_t low;
+
+	__asm__ volatile ("rdtsc" : "=a" (low) : : "edx");
+
+	return low;
+}
@@ -4,4 +4,8 @@
 #define PAGE_SIZE	0x1000 // 4kB
 #define PAGE_SIZE_SHIFT 12
 
+// virtual window for vmalloc()
+#define VMALLOC_START 0xe0000000
+#define VMALLOC_END 0xf0000000
+
 #endif
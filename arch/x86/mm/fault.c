@@ -32,7 +32,7 @@ void handle_page_fault(int exception, struct cpu_context* ctx)
 	if (error.user)
 		flags |= VMM_FAULT_USER;
 
-	fixup_ret = vmm_handle_page_fault(fault_addr, flags);
+	fixup_ret = vmm_handle_page_fault(fault_addr, ctx->eip, flags);
 	if (fixup_ret)
 		ctx->eip = fixup_ret;
 }
@@ -1,5 +1,6 @@
 #include <arch/memory.h>
 #include <dummyos/errno.h>
+#include <kernel/interrupt.h>
 #include <kernel/kassert.h>
 #include <kernel/kernel_image.h>
 #include <kernel/mm/memory.h>
@@ -22,6 +23,11 @@
 
 #define pd_pt_index2v_addr(pd_index, pt_index) (pd_index << 22 | pt_index << 12)
 
+#define CR0_WP (1 << 16) // read-only pages are enforced in kernel mode too
+
+#define CR4_PSE (1 << 4) // 4MB pages
+#define CR4_PGE (1 << 7) // global pages
+
 #define PAGE_DIRECTORY_ENTRY_COUNT	1024
 #define PAGE_TABLE_ENTRY_COUNT		1024
 
@@ -35,7 +41,7 @@ struct page_directory_entry
 	uint8_t accessed:1;
 	uint8_t zero:1;
 	uint8_t page_size:1;
-	uint8_t ignored:1;
+	uint8_t global:1; // 4MB pages only
 	uint8_t available:3;
 
 	p_addr_t address:20;
@@ -65,6 +71,49 @@ static inline void invlpg(v_addr_t addr)
 	__asm__ volatile ("invlpg (%0)" : : "r" (addr) : "memory");
 }
 
+// reloading cr3 flushes the whole TLB (but global pages)
+static inline void flush_tlb(void)
+{
+	__asm__ volatile ("movl %%cr3, %%eax\n\t"
+			  "movl %%eax, %%cr3"
+			  : : : "eax", "memory");
+}
+
+/*
+ * User pages may be invalidated at the end of a batch (see vmm_tlb_batch_*).
+ */
+static inline void invalidate_page(v_addr_t addr)
+{
+	if (!vmm_is_userspace_address(addr) || !vmm_tlb_batch_defer(addr))
+		invlpg(addr);
+}
+
+void paging_invalidate_page(v_addr_t addr)
+{
+	invlpg(addr);
+}
+
+void paging_flush_tlb(void)
+{
+	flush_tlb();
+}
+
+static inline void cr0_set(uint32_t flags)
+{
+	__asm__ volatile ("movl %%cr0, %%eax\n\t"
+			  "orl %0, %%eax\n\t"
+			  "movl %%eax, %%cr0"
+			  : : "r" (flags) : "eax", "memory");
+}
+
+static inline void cr4_set(uint32_t flags)
+{
+	__asm__ volatile ("movl %%cr4, %%eax\n\t"
+			  "orl %0, %%eax\n\t"
+			  "movl %%eax, %%cr4"
+			  : : "r" (flags) : "eax", "memory");
+}
+
 void paging_switch_cr3(p_addr_t cr3)
 {
 	log_printf("Switching cr3 (%p)!\n", (void*)cr3);
@@ -116,10 +165,8 @@ static void clear_recursive_entry(pde_t* pd, v_addr_t recursive_entry_addr)
 
 	memset(recursive_entry, 0, sizeof(pde_t));
 
-	// invalidate the 4MB covered by the pd entry
-	v_addr_t addr = recursive_entry_addr;
-	for (size_t i = 0; i < PAGE_TABLE_ENTRY_COUNT; ++i, addr += PAGE_SIZE)
-		invlpg(addr);
+	// the 4MB covered by the pd entry: cheaper than 1024 invlpg
+	flush_tlb();
 }
 
 static void setup_recursive_entry(pde_t* pd, p_addr_t pd_phys)
@@ -170,6 +217,12 @@ static void cleanup_boot_pt(void)
 	const int pt_index = index_in_pt(kernel_top);
 	for (size_t i = pt_index; i < PAGE_TABLE_ENTRY_COUNT; ++i)
 		memset(&page_table[i], 0, sizeof(pte_t));
+
+	// the kernel image is mapped in every address space
+	for (size_t i = 0; i < PAGE_TABLE_ENTRY_COUNT; ++i) {
+		if (page_table[i].present)
+			page_table[i].global = 1;
+	}
 }
 
 static void remap_kernel(void)
@@ -189,32 +242,205 @@ void paging_init(void)
 	remap_kernel();
 	setup_recursive_entry(&boot_page_directory,
 			      (p_addr_t)&boot_page_directory_phys);
+
+	// the kernel TLB entries now survive cr3 reloads
+	cr4_set(CR4_PGE);
+
+	/*
+	 * Kernel writes to user pages shared copy-on-write (fork, initrd
+	 * files) must fault like user ones, not write through.
+	 */
+	cr0_set(CR0_WP);
 }
 
-int paging_map(p_addr_t paddr, v_addr_t vaddr, int prot)
+static size_t physmap_size; // RAM reachable through the physmap
+static bool kernel_page_tables_shared = false;
+
+static inline bool physmap_covers(p_addr_t frame)
+{
+	return (frame < physmap_size);
+}
+
+static inline void* physmap_addr(p_addr_t frame)
+{
+	return (void*)(PHYSMAP_START + frame);
+}
+
+void paging_physmap_init(size_t mem_size)
+{
+	pde_t* pd = get_page_directory();
+	size_t pdi = index_in_pd(PHYSMAP_START);
+
+	if (mem_size > PHYSMAP_END - PHYSMAP_START)
+		mem_size = PHYSMAP_END - PHYSMAP_START;
+
+	cr4_set(CR4_PSE);
+
+	// whole 4MB pages only, the entries were not present: nothing to flush
+	for (p_addr_t frame = 0;
+	     frame + VM_COVERED_PER_PD_ENTRY <= mem_size;
+	     frame += VM_COVERED_PER_PD_ENTRY, ++pdi)
+	{
+		pd[pdi].present = 1;
+		pd[pdi].read_write = 1;
+		pd[pdi].user = 0;
+		pd[pdi].page_size = 1;
+		pd[pdi].global = 1;
+		pd[pdi].address = p_addr2pd_addr(frame);
+
+		physmap_size = frame + VM_COVERED_PER_PD_ENTRY;
+	}
+}
+
+/*
+ * Gives access to the page directory cr3: through the physmap if it covers
+ * it, through the temporary recursive entry otherwise.
+ */
+static pde_t* map_page_directory(p_addr_t cr3)
+{
+	if (physmap_covers(cr3))
+		return physmap_addr(cr3);
+
+	setup_temp_recursive_entry(cr3);
+
+	return get_temp_page_directory();
+}
+
+static void unmap_page_directory(p_addr_t cr3)
+{
+	if (!physmap_covers(cr3))
+		reset_temp_recursive_entry();
+}
+
+/*
+ * After fork, the user page tables are shared read-only by the parent and
+ * the child: the page directory entry is not writable, and the page table
+ * frame holds a reference per page directory.
+ */
+static inline bool page_table_is_shared(const pde_t* pd, size_t pdi)
+{
+	return (pdi < USER_SPACE_PD_ENTRIES && pd[pdi].present &&
+		!pd[pdi].read_write);
+}
+
+/*
+ * Gives the current page directory its own copy of the shared page table
+ * pdi, before one of its entries is modified. Pages whose frame is still
+ * shared copy-on-write are write-protected in the copy.
+ */
+static int unshare_page_table(size_t pdi)
 {
 	pde_t* pd = get_page_directory();
-	size_t pdi = index_in_pd(vaddr);
 	pte_t* pt = get_page_table(pdi);
-	size_t pti = index_in_pt(vaddr);
+	const p_addr_t shared = pd_addr2p_addr(pd[pdi].address);
 
-	// no page table
-	if (!pd[pdi].present) {
+	// the other page directories may have unshared it already
+	if (memory_page_frame_get_ref(shared) > 1) {
 		p_addr_t page_table = memory_page_frame_alloc();
+		int err;
+
 		if (!page_table)
 			return -ENOMEM;
 
-		pd[pdi].present = 1;
-		pd[pdi].read_write = 1;
-		pd[pdi].user = (prot & VMM_PROT_USER) ? 1 : 0;
+		err = paging_copy_page((v_addr_t)pt, page_table);
+		if (err) {
+			memory_page_frame_free(page_table);
+			return err;
+		}
+
 		pd[pdi].address = p_addr2pd_addr(page_table);
 
-		invlpg((v_addr_t)pt);
+		memory_page_table_set_entries(page_table,
+					      memory_page_table_get_entries(shared));
+		memory_page_frame_unref(shared);
+	}
+
+	// the page table is read-only through the recursive entry until then
+	pd[pdi].read_write = 1;
+	invlpg((v_addr_t)pt);
 
-		memset(pt, 0, PAGE_SIZE);
+	for (size_t i = 0; i < PAGE_TABLE_ENTRY_COUNT; ++i) {
+		if (pt[i].present &&
+		    memory_page_frame_get_ref(pt_addr2p_addr(pt[i].address)) > 1)
+			pt[i].read_write = 0;
+	}
 
-		if (!vmm_is_userspace_address(vaddr))
-			vmm_sync_kernel_space(&pdi);
+	vmm_tlb_batch_begin();
+	for (size_t i = 0; i < PAGE_TABLE_ENTRY_COUNT; ++i) {
+		if (pt[i].present)
+			invalidate_page(pd_pt_index2v_addr(pdi, i));
+	}
+	vmm_tlb_batch_end();
+
+	return 0;
+}
+
+static int alloc_page_table(pde_t* pd, size_t pdi)
+{
+	p_addr_t page_table = memory_page_frame_alloc_zeroed();
+	if (!page_table)
+		return -ENOMEM;
+
+	pd[pdi].present = 1;
+	pd[pdi].read_write = 1;
+	// the page table may hold PROT_NONE (kernel) and user pages
+	pd[pdi].user = (pdi < USER_SPACE_PD_ENTRIES) ? 1 : 0;
+	pd[pdi].address = p_addr2pd_addr(page_table);
+
+	invlpg((v_addr_t)get_page_table(pdi));
+
+	if (pdi < USER_SPACE_PD_ENTRIES)
+		memory_page_table_set_entries(page_table, 0);
+
+	return 0;
+}
+
+/*
+ * Allocates every kernel page table below the physmap, before the first
+ * page directory is created: the page directories all point to the same
+ * kernel page tables, and a kernel mapping is never propagated.
+ */
+int paging_kernel_page_tables_init(void)
+{
+	pde_t* pd = get_page_directory();
+
+	for (size_t pdi = index_in_pd(KERNEL_SPACE_START);
+	     pdi < index_in_pd(PHYSMAP_START);
+	     ++pdi)
+	{
+		if (!pd[pdi].present) {
+			int err = alloc_page_table(pd, pdi);
+			if (err)
+				return err;
+		}
+	}
+
+	kernel_page_tables_shared = true;
+
+	return 0;
+}
+
+int paging_map(p_addr_t paddr, v_addr_t vaddr, int prot)
+{
+	pde_t* pd = get_page_directory();
+	size_t pdi = index_in_pd(vaddr);
+	pte_t* pt = get_page_table(pdi);
+	size_t pti = index_in_pt(vaddr);
+
+	if (page_table_is_shared(pd, pdi)) {
+		int err = unshare_page_table(pdi);
+		if (err)
+			return err;
+	}
+
+	// no page table
+	if (!pd[pdi].present) {
+		// every page directory shares the kernel page tables
+		kassert(pdi < USER_SPACE_PD_ENTRIES || !kernel_page_tables_shared);
+
+		int err = alloc_page_table(pd, pdi);
+		if (err)
+			return err;
 	}
 
 	// a page frame is already mapped for the virtual page
@@ -225,10 +451,15 @@ int paging_map(p_addr_t paddr, v_addr_t vaddr, int prot)
 	pt[pti].present = 1;
 	pt[pti].read_write = (prot & VMM_PROT_WRITE) ? 1 : 0;
 	pt[pti].user = (prot & VMM_PROT_USER) ? 1 : 0;
+	pt[pti].global = (pdi < USER_SPACE_PD_ENTRIES) ? 0 : 1;
 	pt[pti].address = p_addr2pt_addr(paddr);
 
+	// an invalidation of vaddr may still be pending in a batch
 	invlpg(vaddr);
 
+	if (pdi < USER_SPACE_PD_ENTRIES)
+		memory_page_table_add_entries(pd_addr2p_addr(pd[pdi].address), 1);
+
 	return 0;
 }
 
@@ -242,42 +473,68 @@ int paging_unmap(v_addr_t vaddr)
 	if (!pd[pdi].present || !pt[pti].present)
 		return -EFAULT;
 
+	if (page_table_is_shared(pd, pdi)) {
+		int err = unshare_page_table(pdi);
+		if (err)
+			return err;
+	}
+
 	// reset the page table entry
 	memset(&pt[pti], 0, sizeof(pte_t));
 
-	invlpg(vaddr);
+	// the user page tables are freed with their last entry
+	if (pdi < USER_SPACE_PD_ENTRIES) {
+		const p_addr_t page_table = pd_addr2p_addr(pd[pdi].address);
+
+		if (memory_page_table_add_entries(page_table, -1) == 0) {
+			memset(&pd[pdi], 0, sizeof(pde_t));
+			invlpg((v_addr_t)pt);
+			// also drops the page directory entry cached for vaddr
+			invlpg(vaddr);
+
+			memory_page_frame_unref(page_table);
+
+			return 0;
+		}
+	}
+
+	invalidate_page(vaddr);
 
 	return 0;
 }
 
-int paging_sync_kernel_space(p_addr_t cr3, void* data)
+int paging_virt_to_phys(v_addr_t vaddr, p_addr_t* paddr)
 {
-	size_t pdi = *(size_t*)data;
-	pde_t* pd = get_temp_page_directory();
-	pde_t* cur_pd = get_page_directory();
+	pde_t* pd = get_page_directory();
+	size_t pdi = index_in_pd(vaddr);
+	pte_t* pt = get_page_table(pdi);
+	size_t pti = index_in_pt(vaddr);
 
-	setup_temp_recursive_entry(cr3);
+	if (pd[pdi].present && pd[pdi].page_size) {
+		*paddr = pd_addr2p_addr(pd[pdi].address) |
+			(vaddr & (VM_COVERED_PER_PD_ENTRY - 1));
+		return 0;
+	}
 
-	memcpy(&pd[pdi], &cur_pd[pdi], sizeof(pde_t));
+	if (!pd[pdi].present || !pt[pti].present)
+		return -EFAULT;
 
-	reset_temp_recursive_entry();
+	*paddr = pt_addr2p_addr(pt[pti].address) | (vaddr & (PAGE_SIZE - 1));
 
 	return 0;
 }
 
 static int init_kernel_space(p_addr_t cr3, v_addr_t addr, size_t nr_pages)
 {
-	setup_temp_recursive_entry(cr3);
-
-	size_t idx = index_in_pd(addr);
-	pde_t* pd = get_temp_page_directory();
+	pde_t* pd = map_page_directory(cr3);
 	pde_t* cur_pd = get_page_directory();
 
+	size_t idx = index_in_pd(addr);
 	size_t nr_pd_entries = (nr_pages + 1023) / 1024;
 	for (size_t i = idx; i < idx + nr_pd_entries; ++i)
 		pd[i] = cur_pd[i];
 
-	reset_temp_recursive_entry();
+	unmap_page_directory(cr3);
 
 	return 0;
 }
@@ -287,9 +544,13 @@ static int init_pd_recursive_entry(p_addr_t pd)
 	int err;
 	v_addr_t pd_map = KERNEL_SPACE_RESERVED;
 
+	if (physmap_covers(pd)) {
+		setup_recursive_entry(physmap_addr(pd), pd);
+		return 0;
+	}
+
 	err = paging_map(pd, pd_map, VMM_PROT_WRITE);
 	if (!err) {
-		memset((void*)pd_map, 0, PAGE_SIZE);
 		setup_recursive_entry((pde_t*)pd_map, pd);
 		err = paging_unmap(pd_map);
 	}
@@ -314,43 +575,23 @@ int paging_init_pd(p_addr_t cr3)
 
 int paging_clone_current_cow(p_addr_t cr3)
 {
-	setup_temp_recursive_entry(cr3);
-
-	pde_t* pd = get_temp_page_directory();
+	pde_t* pd = map_page_directory(cr3);
 	pde_t* cur_pd = get_page_directory();
 
+	// the page tables are shared, each is copied on its first modification
 	for (size_t i = 0; i < USER_SPACE_PD_ENTRIES; ++i) {
 		if (cur_pd[i].present) {
-			pte_t* pt = get_temp_page_table(i);
-			pte_t* cur_pt = get_page_table(i);
-
-			p_addr_t page_table = memory_page_frame_alloc();
-			if (!page_table)
-				return -ENOMEM;
-
-			pd[i].present = 1;
-			pd[i].read_write = 1;
-			pd[i].user = 1;
-			pd[i].address = p_addr2pd_addr(page_table);
-
-			invlpg((v_addr_t)pt);
-			memset(pt, 0, PAGE_SIZE);
+			memory_page_frame_ref(pd_addr2p_addr(cur_pd[i].address));
 
-			for (size_t j = 0; j < PAGE_TABLE_ENTRY_COUNT; ++j) {
-				if (cur_pt[j].present) {
-					memcpy(&pt[j], &cur_pt[j], sizeof(pte_t));
-
-					// CoW permissions
-					pt[j].read_write = 0;
-					cur_pt[j].read_write = 0;
-
-					invlpg(pd_pt_index2v_addr(i, j));
-				}
-			}
+			cur_pd[i].read_write = 0;
+			memcpy(&pd[i], &cur_pd[i], sizeof(pde_t));
 		}
 	}
 
-	reset_temp_recursive_entry();
+	unmap_page_directory(cr3);
+
+	// the parent lost write access to its whole user space
+	flush_tlb();
 
 	return 0;
 }
@@ -360,6 +601,11 @@ int paging_copy_page(v_addr_t src_page, p_addr_t dst_frame)
 	int err;
 	v_addr_t dst_page = KERNEL_SPACE_RESERVED;
 
+	if (physmap_covers(dst_frame)) {
+		memcpy(physmap_addr(dst_frame), (void*)src_page, PAGE_SIZE);
+		return 0;
+	}
+
 	err = paging_map(dst_frame, dst_page, VMM_PROT_WRITE);
 	if (err)
 		return err;
@@ -371,6 +617,29 @@ int paging_copy_page(v_addr_t src_page, p_addr_t dst_frame)
 	return 0;
 }
 
+int paging_zero_page(p_addr_t frame)
+{
+	int err;
+	v_addr_t page = KERNEL_SPACE_RESERVED_ZERO;
+
+	if (physmap_covers(frame)) {
+		memset(physmap_addr(frame), 0, PAGE_SIZE);
+		return 0;
+	}
+
+	irq_disable();
+
+	err = paging_map(frame, page, VMM_PROT_WRITE);
+	if (!err) {
+		memset((void*)page, 0, PAGE_SIZE);
+		paging_unmap(page);
+	}
+
+	irq_enable();
+
+	return err;
+}
+
 int paging_update_prot(v_addr_t page, int prot)
 {
 	pde_t* pd = get_page_directory();
@@ -381,10 +650,16 @@ int paging_update_prot(v_addr_t page, int prot)
 	if (!pd[pdi].present || !pt[pti].present)
 		return -EINVAL;
 
+	if (page_table_is_shared(pd, pdi)) {
+		int err = unshare_page_table(pdi);
+		if (err)
+			return err;
+	}
+
 	pt[pti].read_write = (prot & VMM_PROT_WRITE) ? 1 : 0;
 	pt[pti].user = (prot & VMM_PROT_USER) ? 1 : 0;
 
-	invlpg(page);
+	invalidate_page(page);
 
 	return 0;
 }
@@ -392,18 +667,16 @@ int paging_update_prot(v_addr_t page, int prot)
 // free page tables
 void paging_clear_userspace(p_addr_t cr3)
 {
-	setup_temp_recursive_entry(cr3);
-
-	pde_t* pd = get_temp_page_directory();
+	pde_t* pd = map_page_directory(cr3);
 
 	for (size_t i = 0; i < USER_SPACE_PD_ENTRIES; ++i) {
 		if (pd[i].present) {
-			memory_page_frame_free(pd_addr2p_addr(pd[i].address));
+			memory_page_frame_unref(pd_addr2p_addr(pd[i].address));
 			memset(&pd[i], 0, sizeof(pde_t));
 		}
 	}
 
-	reset_temp_recursive_entry();
+	unmap_page_directory(cr3);
 }
 
 #if 0
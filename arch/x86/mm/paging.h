@@ -7,14 +7,24 @@ void paging_switch_cr3(p_addr_t cr3);
 
 void paging_init(void);
 
+/**
+ * @brief Maps the RAM below mem_size, up to the size of the physmap window
+ */
+void paging_physmap_init(size_t mem_size);
+
 int paging_init_pd(p_addr_t cr3);
 
-int paging_sync_kernel_space(p_addr_t cr3, void* data);
+/**
+ * @brief Allocates the kernel page tables shared by all the page directories
+ */
+int paging_kernel_page_tables_init(void);
 
 int paging_clone_current_cow(p_addr_t cr3);
 
 int paging_copy_page(v_addr_t src_page, p_addr_t dst_frame);
 
+int paging_zero_page(p_addr_t frame);
+
 int paging_update_prot(v_addr_t page, int prot);
 
 void paging_clear_userspace(p_addr_t cr3);
@@ -23,4 +33,13 @@ int paging_map(p_addr_t paddr, v_addr_t vaddr, int prot);
 
 int paging_unmap(v_addr_t vaddr);
 
+int paging_virt_to_phys(v_addr_t vaddr, p_addr_t* paddr);
+
+void paging_invalidate_page(v_addr_t vaddr);
+
+/**
+ * @brief Flushes the TLB entries, but the global (kernel) ones
+ */
+void paging_flush_tlb(void);
+
 #endif
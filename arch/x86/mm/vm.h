@@ -13,8 +13,10 @@
  * |   |temp              |
  * |   |recursive mapping |
  * |   +------------------+ 4GB - 8MB (0xff800000)
+ * |   | physmap          |
+ * |   |                  |
  * |   +------------------+ 4GB - 256MB (0xf0000000)
- * |   | drivers, etc...  |
+ * |   | vmalloc          |
  * |   |                  |
  * |   +------------------+ 4GB - 512MB (0xe0000000)
  * | kernel address space |
@@ -44,8 +46,16 @@
 
 #define RECURSIVE_ENTRY_START		0xffc00000 // 4GB - 4MB
 #define KERNEL_SPACE_RESERVED		KERNEL_SPACE_START
+#define KERNEL_SPACE_RESERVED_ZERO	(KERNEL_SPACE_RESERVED + PAGE_SIZE)
 #define TEMP_RECURSIVE_ENTRY_START	0xff800000 // 4GB - 8MB
 
+/*
+ * linear mapping of the low RAM (physical address 0 at PHYSMAP_START), with
+ * 4MB pages
+ */
+#define PHYSMAP_START			0xf0000000 // 4GB - 256MB
+#define PHYSMAP_END			TEMP_RECURSIVE_ENTRY_START
+
 /*
  * page directory entry count
  */
@@ -25,7 +25,7 @@ static int create_pd_and_init_kernel(struct x86_vmm* x86vmm)
 	p_addr_t pd;
 	int err;
 
-	pd = memory_page_frame_alloc();
+	pd = memory_page_frame_alloc_zeroed();
 	if (!pd)
 		return -ENOMEM;
 
@@ -85,27 +85,24 @@ static int clone_current(struct vmm* clone)
 	return paging_clone_current_cow(x86clone->cr3);
 }
 
-static int sync_kernel_space(struct vmm* vmm, void* data)
-{
-	const struct x86_vmm* x86vmm = get_x86_vmm(vmm);
-
-	return paging_sync_kernel_space(x86vmm->cr3, data);
-}
-
 static const struct vmm_interface impl = {
 	.create				= create,
 	.destroy			= destroy,
 	.switch_to			= switch_to,
 	.clone_current			= clone_current,
-	.sync_kernel_space		= sync_kernel_space,
 
 	.copy_page			= paging_copy_page,
+	.zero_page			= paging_zero_page,
 	.update_kernel_page_prot	= paging_update_prot,
 	.map_kernel_page		= paging_map,
 	.unmap_kernel_page		= paging_unmap,
+	.virt_to_phys			= paging_virt_to_phys,
 	.update_user_page_prot		= paging_update_prot,
 	.map_user_page			= paging_map,
 	.unmap_user_page		= paging_unmap,
+
+	.invalidate_tlb_page		= paging_invalidate_page,
+	.flush_user_tlb			= paging_flush_tlb,
 };
 
 int x86_vmm_register(void)
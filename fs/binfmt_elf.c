@@ -36,6 +36,63 @@ static bool check_header(const struct elf_header* e_hdr)
 	return true;
 }
 
+/*
+ * Maps a segment onto the file contents, for files kept in memory: whole
+ * pages are shared with the file (copy-on-write if the segment is writable)
+ * and only the bss is allocated.
+ */
+static int map_segment(struct vfs_file* binfile, v_addr_t start, size_t size,
+		       int prot, off_t offset, size_t filesz)
+{
+	const void* data;
+	size_t data_size;
+	int err;
+
+	err = binfile->op->mmap(binfile, offset, &data, &data_size);
+	if (err)
+		return err;
+	if (data_size < filesz)
+		return -ENOEXEC;
+
+	return vmm_create_user_file_mapping(start, size, prot, 0, data, filesz);
+}
+
+/*
+ * Reads a segment into a new anonymous mapping.
+ */
+static int load_segment(struct vfs_file* binfile, v_addr_t start, size_t size,
+			int prot, off_t offset, size_t head, size_t filesz)
+{
+	void* buffer;
+	int err;
+
+	err = vmm_create_user_mapping(start, size, prot | VMM_PROT_WRITE, 0);
+	if (err)
+		return err;
+
+	// read segment into memory
+	if (binfile->op->lseek(binfile, offset, SEEK_SET) != offset)
+		return -EIO;
+
+	buffer = kvmalloc_tagged(filesz, "binfmt_elf");
+	if (!buffer)
+		return -ENOMEM;
+
+	if (binfile->op->read(binfile, buffer, filesz) != filesz)
+		err = -EIO;
+	else
+		err = copy_to_user((void*)(start + head), buffer, filesz);
+
+	kvfree(buffer);
+
+	// no zero fill: the mapping frames come zeroed
+
+	if (!err && !(prot & VMM_PROT_WRITE))
+		err = vmm_update_user_mapping_prot(start, prot);
+
+	return err;
+}
+
 int elf_load_binary(struct vfs_file* binfile, struct process_image* img)
 {
 	struct elf_header e_hdr;
@@ -63,7 +120,7 @@ int elf_load_binary(struct vfs_file* binfile, struct process_image* img)
 		return -ENOEXEC;
 
 	size_t size = phdr_size * phdr_num;
-	e_phdr = kmalloc(size);
+	e_phdr = kmalloc_tagged(size, "binfmt_elf");
 	if (!e_phdr)
 		return -ENOMEM;
 
@@ -110,46 +167,19 @@ int elf_load_binary(struct vfs_file* binfile, struct process_image* img)
 		}
 		start = align_down(vaddr, PAGE_SIZE);
 
-		uint8_t vmm_flags = VMM_PROT_USER | VMM_PROT_WRITE;
-		if (flags & PF_X) vmm_flags |= VMM_PROT_EXEC;
-		err = vmm_create_user_mapping(start, vaddr - start + memsz, vmm_flags, 0);
+		const size_t head = vaddr - start;
+		int prot = VMM_PROT_USER;
+		if (flags & PF_W) prot |= VMM_PROT_WRITE;
+		if (flags & PF_X) prot |= VMM_PROT_EXEC;
+
+		if (binfile->op->mmap && offset >= (off_t)head)
+			err = map_segment(binfile, start, head + memsz, prot,
+					  offset - head, head + filesz);
+		else
+			err = load_segment(binfile, start, head + memsz, prot,
+					   offset, head, filesz);
 		if (err)
 			goto end;
-
-
-		// read segment into memory
-		if (binfile->op->lseek(binfile, offset, SEEK_SET) != offset) {
-			err = -EIO;
-			goto end;
-		}
-		void* buffer = kmalloc(filesz);
-		if (!buffer) {
-			err = -ENOMEM;
-			goto end;
-		}
-		if (binfile->op->read(binfile, buffer, filesz) != filesz) {
-			err = -EIO;
-			kfree(buffer);
-			goto end;
-		}
-
-		err = copy_to_user((void*)vaddr, buffer, filesz);
-		if (err) {
-			kfree(buffer);
-			goto end;
-		}
-
-		// zero fill
-		if (filesz < memsz)
-			memset_user((int8_t*)vaddr + filesz, 0, memsz - filesz);
-
-		kfree(buffer);
-
-		if (!(flags & PF_W)) {
-			err = vmm_update_user_mapping_prot(start, vmm_flags & ~VMM_PROT_WRITE);
-			if (err)
-				goto end;
-		}
 	}
 
 	img->brk = align_up(_end, PAGE_SIZE);
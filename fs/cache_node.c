@@ -3,6 +3,7 @@
 #include <fs/vfs.h>
 #include <kernel/kassert.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <libk/libk.h>
 #include <libk/refcount.h>
 #include <libk/utils.h>
@@ -12,11 +13,18 @@
 static struct vfs_inode cnode_root_inode;
 static struct vfs_cache_node* cache_node_root = NULL;
 
+static struct kmem_cache* cache_node_cache;
+
 int vfs_cache_init(void)
 {
 	vfs_path_t root_path;
 	int err;
 
+	err = kmem_cache_create("vfs_cache_node", sizeof(struct vfs_cache_node),
+				NULL, &cache_node_cache);
+	if (err)
+		return err;
+
 	vfs_inode_init(&cnode_root_inode, DIRECTORY, NULL, NULL);
 
 	err = vfs_path_init(&root_path, "/", 1);
@@ -32,13 +40,13 @@ int vfs_cache_init(void)
 int vfs_cache_node_create(struct vfs_inode* inode, const vfs_path_t* name,
 			  struct vfs_cache_node** result)
 {
-	struct vfs_cache_node* node = kmalloc(sizeof(struct vfs_cache_node));
+	struct vfs_cache_node* node = kmem_cache_alloc(cache_node_cache);
 	if (!node)
 		return -ENOMEM;
 
 	int err = vfs_cache_node_init(node, inode, name);
 	if (err) {
-		kfree(node);
+		kmem_cache_free(cache_node_cache, node);
 		node = NULL;
 	}
 
@@ -107,7 +115,7 @@ static void vfs_cache_node_reset(struct vfs_cache_node* node)
 static void vfs_cache_node_destroy(struct vfs_cache_node* node)
 {
 	vfs_cache_node_reset(node);
-	kfree(node);
+	kmem_cache_free(cache_node_cache, node);
 }
 
 static void insert_child(struct vfs_cache_node* parent,
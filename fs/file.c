@@ -5,12 +5,21 @@
 #include <fs/pipe.h>
 #include <fs/vfs.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <kernel/process.h>
 #include <kernel/sched/sched.h>
 #include <libk/libk.h>
 
 static void vfs_file_destroy(struct vfs_file* file);
 
+static struct kmem_cache* vfs_file_cache;
+
+int vfs_file_cache_init(void)
+{
+	return kmem_cache_create("vfs_file", sizeof(struct vfs_file), NULL,
+				 &vfs_file_cache);
+}
+
 static inline void vfs_file_init_data_fields(struct vfs_file* file, off_t cur,
 					     struct vfs_file_operations* op)
 {
@@ -45,13 +54,13 @@ int vfs_file_create(struct vfs_cache_node* cnode, int flags,
 	struct vfs_file* file;
 	int err;
 
-	file = kmalloc(sizeof(struct vfs_file));
+	file = kmem_cache_alloc(vfs_file_cache);
 	if (!file)
 		return -ENOMEM;
 
 	err = vfs_file_init(file, cnode, flags);
 	if (err) {
-		kfree(file);
+		kmem_cache_free(vfs_file_cache, file);
 		file = NULL;
 	}
 
@@ -147,7 +156,7 @@ static void vfs_file_reset(struct vfs_file* file)
 static void vfs_file_destroy(struct vfs_file* file)
 {
 	vfs_file_reset(file);
-	kfree(file);
+	kmem_cache_free(vfs_file_cache, file);
 }
 
 struct vfs_cache_node* vfs_file_get_cache_node(const struct vfs_file* file)
@@ -95,7 +95,7 @@ ssize_t sys_read(int fd, void* __user buf, size_t count)
 	if (!file->op || !file->op->read)
 		return -EIO;
 
-	kbuf = kmalloc(count);
+	kbuf = kvmalloc_tagged(count, "vfs_io");
 	if (!kbuf)
 		return -ENOMEM;
 
@@ -106,7 +106,7 @@ ssize_t sys_read(int fd, void* __user buf, size_t count)
 			ret = err;
 	}
 
-	kfree(kbuf);
+	kvfree(kbuf);
 
 	return ret;
 }
@@ -127,7 +127,7 @@ ssize_t sys_write(int fd, const void* __user buf, size_t count)
 	if (!file->op || !file->op->write)
 		return -EIO;
 
-	kbuf = kmalloc(count);
+	kbuf = kvmalloc_tagged(count, "vfs_io");
 	if (!kbuf)
 		return -ENOMEM;
 
@@ -137,7 +137,7 @@ ssize_t sys_write(int fd, const void* __user buf, size_t count)
 	else
 		ret = file->op->write(file, kbuf, count);
 
-	kfree(kbuf);
+	kvfree(kbuf);
 
 	return ret;
 }
@@ -1,6 +1,7 @@
 #include <dummyos/errno.h>
 #include <fs/path.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <libk/libk.h>
 #include <libk/utils.h>
 
@@ -38,6 +39,14 @@ vfs_path_offset_t first_non_slash(const char* str, vfs_path_size_t size)
 /*
  * string_t
  */
+static struct kmem_cache* string_cache;
+
+int vfs_path_cache_init(void)
+{
+	return kmem_cache_create("vfs_path_string", sizeof(string_t), NULL,
+				 &string_cache);
+}
+
 static char* copy_path_str(const char* path, vfs_path_size_t size)
 {
 	char* new_path = kmalloc(size);
@@ -55,13 +64,13 @@ static int vfs_path_string_create(const char* path, vfs_path_size_t size,
 	string_t* str;
 	char* path_cpy;
 
-	str = kmalloc(sizeof(string_t));
+	str = kmem_cache_alloc(string_cache);
 	if (!str)
 		return -ENOMEM;
 
 	path_cpy = copy_path_str(path, size);
 	if (!path_cpy) {
-		kfree(str);
+		kmem_cache_free(string_cache, str);
 		return -ENOMEM;
 	}
 
@@ -78,7 +87,7 @@ static void vfs_path_string_destroy(string_t* string)
 {
 	if (refcount_dec(&string->refcnt) == 0) {
 		kfree(string->str);
-		kfree(string);
+		kmem_cache_free(string_cache, string);
 	}
 }
 
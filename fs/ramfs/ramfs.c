@@ -676,6 +676,26 @@ ssize_t ramfs_write(struct vfs_file* this, const void* buf, size_t count)
 	return -EROFS;
 }
 
+int ramfs_mmap(struct vfs_file* this, off_t offset, const void** data,
+	       size_t* size)
+{
+	struct vfs_inode* inode = vfs_file_get_inode(this);
+
+	if (inode->type != REGULAR)
+		return -ENODEV;
+
+	// the files are mapped straight from the archive
+	const struct ramfs_inode_info* ramfs_inode = get_ramfs_inode(inode);
+
+	if (offset < 0 || (size_t)offset > ramfs_inode->data_size)
+		return -ENXIO;
+
+	*data = (int8_t*)ramfs_inode->data + offset;
+	*size = ramfs_inode->data_size - offset;
+
+	return 0;
+}
+
 /*
  * objects initialization
  */
@@ -706,6 +726,7 @@ static struct vfs_file_operations ramfs_file_op = {
 	.lseek		= ramfs_lseek,
 	.read		= ramfs_read,
 	.write		= ramfs_write,
+	.mmap		= ramfs_mmap,
 };
 
 int ramfs_init_and_register(void)
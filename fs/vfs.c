@@ -29,6 +29,14 @@ int vfs_init(void)
 {
 	int err;
 
+	err = vfs_path_cache_init();
+	if (err)
+		return err;
+
+	err = vfs_file_cache_init();
+	if (err)
+		return err;
+
 	err = vfs_cache_init();
 	if (err)
 		return err;
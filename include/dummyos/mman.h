@@ -0,0 +1,46 @@
+#ifndef _DUMMYOS_MMAN_H_
+#define _DUMMYOS_MMAN_H_
+
+#include <dummyos/types.h>
+
+/*
+ * @brief mmap() and mprotect() protections
+ */
+#define PROT_NONE	0x0
+#define PROT_READ	0x1
+#define PROT_WRITE	0x2
+#define PROT_EXEC	0x4
+
+/*
+ * @brief mmap() flags
+ */
+#define MAP_SHARED	0x01
+#define MAP_PRIVATE	0x02
+#define MAP_FIXED	0x10
+#define MAP_ANONYMOUS	0x20
+
+/*
+ * @brief mmap() errors
+ *
+ * On failure, mmap() returns a negative errno value, (void*)-MMAP_ERRNO_MAX to
+ * (void*)-1, not MAP_FAILED. No mapping lies in that range.
+ */
+#define MMAP_ERRNO_MAX		4095
+#define MMAP_IS_ERR(addr)	((unsigned long)(addr) >= -(unsigned long)MMAP_ERRNO_MAX)
+
+/**
+ * @brief mmap() arguments
+ *
+ * Syscalls take at most 5 arguments: mmap() takes a pointer to this instead.
+ */
+struct mmap_args
+{
+	void* addr;
+	size_t length;
+	int prot;
+	int flags;
+	int fd;
+	off_t offset;
+};
+
+#endif
@@ -35,8 +35,11 @@
 #define SYS_stat		29
 #define SYS_fstat		30
 #define SYS_nanosleep		31
+#define SYS_mmap		32
+#define SYS_munmap		33
+#define SYS_mprotect		34
 
-#define _SYSCALL_NR_TOP		31 /**< last syscall number */
+#define _SYSCALL_NR_TOP		34 /**< last syscall number */
 #define _SYSCALL_NR_COUNT	(_SYSCALL_NR_TOP + 1) /**< number of syscalls */
 
 #endif
@@ -56,9 +56,24 @@ struct vfs_file_operations
 	ssize_t (*read)(struct vfs_file* this, void* buf, size_t count);
 	ssize_t (*write)(struct vfs_file* this, const void* buf, size_t count);
 	int (*ioctl)(struct vfs_file* this, int request, intptr_t arg);
+
+	/**
+	 * @brief Gives access to the file contents from offset on, for file
+	 * systems keeping them in memory (mmap)
+	 *
+	 * @param data set to the address of the contents at offset
+	 * @param size set to the number of bytes available from offset
+	 */
+	int (*mmap)(struct vfs_file* this, off_t offset, const void** data,
+		    size_t* size);
 };
 
 
+/**
+ * @brief Creates the object cache for vfs_file objects
+ */
+int vfs_file_cache_init(void);
+
 /**
  * @brief Creates a vfs_file object
  */
@@ -55,6 +55,11 @@ vfs_path_component_as_path(const vfs_path_component_t* component)
 }
 
 
+/**
+ * @brief Creates the object cache for path strings
+ */
+int vfs_path_cache_init(void);
+
 /**
  * @brief Creates a vfs_path_t object taking ownership of the pointer path
  *
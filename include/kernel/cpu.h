@@ -1,6 +1,8 @@
 #ifndef _KERNEL_CPU_H_
 #define _KERNEL_CPU_H_
 
+#include <kernel/types.h>
+
 struct cpu_info
 {
 	const char* cpu_vendor;
@@ -8,4 +10,10 @@ struct cpu_info
 
 struct cpu_info* cpu_info(void);
 
+/*
+ * Free running cycle counter. It wraps around: only differences between two
+ * reads are meaningful.
+ */
+uint32_t cpu_cycles(void);
+
 #endif
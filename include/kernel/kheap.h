@@ -12,8 +12,8 @@
  * @return the size of the initialized kernel heap
  * If the return value < initial_size => error
  *
- * @note start should be aligned to the required kmalloc alignment.
- * See kmalloc.c, ALIGNMENT is 16.
+ * @note start should be page-aligned: kmalloc finds the header of a block by
+ * rounding an address down to the page boundary.
  */
 size_t kheap_init(v_addr_t start);
 
@@ -25,6 +25,17 @@ size_t kheap_init(v_addr_t start);
  */
 size_t kheap_sbrk(size_t increment);
 
+/**
+ * @brief Decreases the heap size by a certain decrement in bytes, giving the
+ * pages at the end of the heap back to the system
+ *
+ * The heap never shrinks below its initial size.
+ *
+ * @param decrement decrement in bytes, rounded down to a page boundary
+ * @return the number of bytes removed from the heap
+ */
+size_t kheap_trim(size_t decrement);
+
 /**
  * @brief Returns the starting address of the heap
  */
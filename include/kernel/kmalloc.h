@@ -3,14 +3,88 @@
 
 #include <kernel/types.h>
 
+// request size buckets: up to 16 << i bytes, the last one takes the rest
+#define KMALLOC_HISTOGRAM_BUCKETS 12
+
+struct kmalloc_stats
+{
+	size_t heap_size;
+	size_t free_bytes; // in free heap blocks, free slab objects excluded
+	size_t largest_free_block;
+
+	size_t histogram[KMALLOC_HISTOGRAM_BUCKETS];
+};
+
+struct kmalloc_site_stats
+{
+	const void* caller; // NULL for tagged allocations
+	const char* tag;
+
+	size_t live_bytes;
+	size_t nr_allocs;
+	size_t nr_frees;
+};
+
 v_addr_t kmalloc_early(size_t size);
 
 void kmalloc_init(v_addr_t kheap_start, size_t kheap_size);
 
 void* kmalloc(size_t size);
 
+/**
+ * @brief Same as kmalloc(), the allocation being accounted to tag rather than
+ * to the caller in the profiler
+ */
+void* kmalloc_tagged(size_t size, const char* tag);
+
 void* kcalloc(size_t count, size_t size);
 
 void kfree(void* ptr);
 
+/**
+ * @brief Allocates memory with kmalloc(), or with vmalloc() for large sizes
+ *
+ * To be used for large buffers that need not be physically contiguous.
+ * Such memory must be freed with kvfree().
+ */
+void* kvmalloc(size_t size);
+
+/**
+ * @brief Same as kvmalloc(), the allocation being accounted to tag rather
+ * than to the caller in the profiler
+ */
+void* kvmalloc_tagged(size_t size, const char* tag);
+
+void* kvcalloc(size_t count, size_t size);
+
+void kvfree(void* ptr);
+
+/**
+ * @brief Accounts an allocation served outside of the heap to the profiler
+ *
+ * @param key the caller, or the tag if tagged
+ * @param size the requested size
+ * @param bytes the memory actually used
+ * @return the allocation site, to be passed to kmalloc_profile_free()
+ */
+uint8_t kmalloc_profile_alloc(const void* key, bool tagged, size_t size,
+			      size_t bytes);
+
+void kmalloc_profile_free(uint8_t site, size_t bytes);
+
+void kmalloc_statistics(struct kmalloc_stats* stats);
+
+/**
+ * @brief Copies the statistics of up to n allocation sites to result
+ *
+ * @return the number of sites copied
+ */
+size_t kmalloc_site_statistics(struct kmalloc_site_stats* result, size_t n);
+
+/**
+ * @brief Logs the heap statistics, the live allocations per site and the
+ * object caches statistics
+ */
+void kmalloc_dump_statistics(void);
+
 #endif
@@ -0,0 +1,69 @@
+#ifndef _KERNEL_KMEM_CACHE_H_
+#define _KERNEL_KMEM_CACHE_H_
+
+#include <kernel/types.h>
+#include <libk/list.h>
+
+/**
+ * @brief Object constructor
+ *
+ * Called once on each object when its slab is created. Objects must be
+ * returned to their constructed state before being freed.
+ */
+typedef void (*kmem_cache_ctor_t)(void* obj);
+
+struct kmem_cache_stats
+{
+	size_t nr_allocs;
+	size_t nr_frees;
+	size_t nr_active_objs;
+	size_t nr_slabs;
+};
+
+/**
+ * @brief Object cache
+ *
+ * Objects of a cache are carved out of single-page slabs taken from the
+ * kernel heap. Freed objects are handed out again first (LIFO), so that they
+ * are still hot in the CPU cache.
+ */
+struct kmem_cache
+{
+	const char* name;
+
+	size_t obj_size;
+	size_t size; // size of a slot: object and free list link
+	size_t link_offset; // offset of the free list link in a slot
+	size_t objs_offset; // offset of the first object in a slab
+	size_t objs_per_slab;
+	bool track_sites; // record the allocation site of each object (kmalloc)
+
+	kmem_cache_ctor_t ctor;
+
+	list_t partial; // slabs with at least one free object
+
+	struct kmem_cache_stats stats;
+
+	list_node_t c_list;
+};
+
+/**
+ * @brief Creates an object cache
+ *
+ * @param name name of the cache, not copied
+ * @param size size of the objects
+ * @param ctor constructor, may be NULL
+ * @return 0 on success \n
+ *		-EINVAL if an object does not fit in a slab
+ */
+int kmem_cache_create(const char* name, size_t size, kmem_cache_ctor_t ctor,
+		      struct kmem_cache** result);
+
+void* kmem_cache_alloc(struct kmem_cache* cache);
+
+void kmem_cache_free(struct kmem_cache* cache, void* obj);
+
+void kmem_cache_statistics(const struct kmem_cache* cache,
+			   struct kmem_cache_stats* stats);
+
+#endif
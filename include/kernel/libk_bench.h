@@ -0,0 +1,10 @@
+#ifndef _KERNEL_LIBK_BENCH_H_
+#define _KERNEL_LIBK_BENCH_H_
+
+/*
+ * Measures the throughput of the libk memory and string functions and prints
+ * it on the terminal (meson option libk_bench).
+ */
+void libk_bench(void);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _KERNEL_MM_EXTABLE_H_
+#define _KERNEL_MM_EXTABLE_H_
+
+/*
+ * exception table: the kernel instructions allowed to fault on a user
+ * address, each with the address execution resumes at when it does
+ */
+
+#ifdef ASSEMBLY
+
+#define EXTABLE(insn, fixup)			\
+	.pushsection __ex_table, "a";		\
+	.balign 4;				\
+	.long insn, fixup;			\
+	.popsection
+
+#else
+
+#include <kernel/types.h>
+
+struct extable_entry
+{
+	v_addr_t insn;
+	v_addr_t fixup;
+};
+
+/**
+ * @brief Returns where to resume after a fault at insn, or 0 if insn is not
+ * allowed to fault
+ */
+v_addr_t extable_search(v_addr_t insn);
+
+#endif // ASSEMBLY
+
+#endif
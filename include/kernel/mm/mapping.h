@@ -4,6 +4,7 @@
 #include <kernel/mm/memory.h>
 #include <kernel/mm/region.h>
 #include <libk/list.h>
+#include <libk/rbtree.h>
 
 typedef struct mapping
 {
@@ -15,6 +16,9 @@ typedef struct mapping
 	region_t* region;
 
 	list_node_t m_list;
+	rb_node_t m_rb;
+	size_t gap; // free space between the previous mapping and this one
+	size_t max_gap; // largest gap in the m_rb subtree
 } mapping_t;
 
 static inline size_t mapping_size_in_pages(const mapping_t* mapping)
@@ -33,17 +37,55 @@ static inline v_addr_t mapping_get_end(const mapping_t* mapping)
 	return (mapping->start + mapping->size - 1);
 }
 
+/**
+ * @brief Creates the object cache for mappings
+ */
+int mapping_cache_init(void);
+
 int __mapping_init(mapping_t* mapping, region_t* region, v_addr_t start,
 		   size_t size, int flags);
 
 int mapping_create_from_range(v_addr_t mstart, p_addr_t pstart, size_t size,
 			      int prot, int flags, mapping_t** result);
 
+/**
+ * @brief Creates a mapping of the whole region at start
+ *
+ * The mapping takes its own reference on the region.
+ */
+int mapping_create_from_region(v_addr_t start, region_t* region, int flags,
+			       mapping_t** result);
+
 int mapping_create(v_addr_t start, size_t size, int prot, int flags,
 		   mapping_t** result);
 
 int mapping_copy_create(const mapping_t* src, mapping_t** result);
 
+/**
+ * @brief Splits mapping in two at addr
+ *
+ * mapping keeps the pages below addr, result gets the others.
+ */
+int mapping_split(mapping_t* mapping, v_addr_t addr, mapping_t** result);
+
+/**
+ * @brief Checks that next directly follows mapping, and that they can be
+ * merged into a single mapping
+ */
+bool mapping_can_merge(const mapping_t* mapping, const mapping_t* next);
+
+/**
+ * @brief Moves the pages of next to the end of mapping
+ *
+ * next is left empty and can then be destroyed.
+ */
+int mapping_merge(mapping_t* mapping, mapping_t* next);
+
+/**
+ * @brief Extends mapping up by size bytes, the new pages are not populated
+ */
+int mapping_grow_up(mapping_t* mapping, size_t size);
+
 void mapping_destroy(mapping_t* mapping);
 
 void mapping_reset(mapping_t* mapping);
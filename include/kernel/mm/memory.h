@@ -1,6 +1,7 @@
 #ifndef _KERNEL_MM_MEMORY_H_
 #define _KERNEL_MM_MEMORY_H_
 
+#include <config.h>
 #include <kernel/types.h>
 #include <libk/list.h>
 #include <libk/utils.h>
@@ -58,13 +59,128 @@ static inline bool page_is_aligned(p_addr_t addr)
 
 void __memory_early_init(void);
 
+/** memory initialized by memory_init() above the early frames */
+#define MEMORY_INIT_SYNC_MB 16
+/** frames initialized at a time by the deferred initialization: 4MB */
+#define MEMORY_DEFERRED_INIT_CHUNK 1024
+
+/**
+ * @brief Initializes the page frame allocator
+ *
+ * Only the first MEMORY_INIT_SYNC_MB of memory above the early frames are
+ * made available, the rest is deferred to memory_deferred_init().
+ */
 void memory_init(size_t ram_size_bytes, const mem_area_t* mem_layout,
 		 size_t layout_len);
 
+/**
+ * @brief Initializes the next MEMORY_DEFERRED_INIT_CHUNK deferred frames
+ *
+ * @return the number of frames initialized, 0 once all memory is available
+ */
+size_t memory_deferred_init(void);
+
+/**
+ * @brief Starts the [meminit] kthread, which completes the deferred
+ * initialization in the background
+ */
+int memory_deferred_init_start(void);
+
+/** largest block handed out by the buddy allocator: 2^10 frames (4MB) */
+#define MEMORY_PAGE_FRAMES_MAX_ORDER 10
+
+/** number of frames the idle thread keeps cleared in advance */
+#define MEMORY_ZEROED_POOL_SIZE 64
+
+#ifdef MEMORY_PAGE_COLORS
+/**
+ * @brief Sets the page color cursor
+ *
+ * Single frame allocations take the color *cursor holds, then advance it
+ * round-robin. NULL disables coloring.
+ */
+void memory_set_color_cursor(unsigned int* cursor);
+#endif
+
 p_addr_t memory_page_frame_alloc(void);
 
 int memory_page_frame_free(p_addr_t addr);
 
+/**
+ * @brief Takes an additional reference on an allocated page frame
+ *
+ * Frames shared copy-on-write are referenced once per region holding them.
+ * The frame is only freed by the memory_page_frame_unref() dropping the last
+ * reference.
+ */
+int memory_page_frame_ref(p_addr_t addr);
+
+/**
+ * @brief Drops a reference on a page frame, freeing it if it was the last
+ */
+int memory_page_frame_unref(p_addr_t addr);
+
+/**
+ * @brief Returns the number of references on an allocated page frame
+ */
+unsigned int memory_page_frame_get_ref(p_addr_t addr);
+
+/*
+ * Count of valid entries in a user page table, so that the table can be freed
+ * when its last entry goes away. The count is only meaningful while the frame
+ * holds a page table: it is set when the table is allocated.
+ */
+void memory_page_table_set_entries(p_addr_t addr, unsigned int n);
+
+unsigned int memory_page_table_get_entries(p_addr_t addr);
+
+/**
+ * @brief Adds n (possibly negative) to the count of valid entries of the
+ * page table held by the frame at addr
+ *
+ * @return the new count \n
+ *		-EINVAL if the frame is not managed by the allocator
+ */
+int memory_page_table_add_entries(p_addr_t addr, int n);
+
+/**
+ * @brief Allocates a page frame filled with zeros
+ *
+ * The frame is taken from the pool of frames cleared in advance by the idle
+ * thread, or cleared inline if the pool is empty.
+ */
+p_addr_t memory_page_frame_alloc_zeroed(void);
+
+/**
+ * @brief Clears up to max free frames into the zeroed frames pool
+ *
+ * @return the number of frames added to the pool
+ */
+size_t memory_zeroed_pool_refill(size_t max);
+
+/**
+ * @brief Allocates 2^order physically contiguous page frames
+ *
+ * The block is aligned on a 2^order frames boundary. Frames of the block may
+ * be freed one by one with memory_page_frame_free().
+ *
+ * @return the address of the first frame, 0 if no block is available
+ */
+p_addr_t memory_page_frames_alloc(unsigned int order);
+
+/**
+ * @brief Allocates the largest available block of at most nr_frames
+ * contiguous page frames
+ *
+ * @param order where to store the order of the allocated block
+ */
+p_addr_t memory_page_frames_alloc_max(size_t nr_frames, unsigned int* order);
+
+/**
+ * @brief Frees a block allocated by memory_page_frames_alloc()
+ */
+int memory_page_frames_free(p_addr_t addr, unsigned int order);
+
 void memory_statistics(unsigned int* nb_used_page_frames,
 		       unsigned int* nb_free_page_frames);
 
@@ -4,24 +4,150 @@
 #include <kernel/types.h>
 #include <libk/refcount.h>
 
+/*
+ * run of physically contiguous frames
+ */
+struct region_extent
+{
+	p_addr_t start;
+	size_t nr_frames;
+};
+
 typedef struct region region_t;
 struct region
 {
 	int prot;
 
+	/*
+	 * backing frames: one entry per page in frames, or runs of contiguous
+	 * frames in extents (frames is then NULL)
+	 */
 	p_addr_t* frames;
+	struct region_extent* extents;
+	size_t nr_extents;
+	struct region_extent extent; // storage when there is a single extent
 	size_t nr_frames;
 
 	refcount_t refcnt;
 };
 
+static inline bool region_is_extent_based(const region_t* region)
+{
+	return (region->extents != NULL);
+}
+
+/**
+ * @brief Creates the object cache for regions
+ */
+int region_cache_init(void);
+
 int __region_init(region_t* region, p_addr_t* frames, size_t nr_frames,
-		  int prot);
+		  int prot, bool zeroed);
 
 int region_create_from_range(p_addr_t start, size_t size, int prot,
 			     region_t** result);
 
-int region_create(size_t nr_frames, int prot, region_t** result);
+/**
+ * @brief Creates a region without any page, described by extents
+ *
+ * The pages are added with region_append_frames().
+ */
+int region_create_extents(int prot, region_t** result);
+
+/**
+ * @brief Appends nr_frames pages backed by the contiguous frames from start
+ *
+ * The frames are merged into the last extent if they follow it. The region
+ * takes over a reference on each frame.
+ *
+ * @return 0 on success \n
+ *		-EINVAL if the region is not described by extents \n
+ *		-ENOMEM if the extent array cannot be grown
+ */
+int region_append_frames(region_t* region, p_addr_t start, size_t nr_frames);
+
+/**
+ * @brief Creates a region backed by zero-filled frames
+ */
+int region_create_zeroed(size_t nr_frames, int prot, region_t** result);
+
+/**
+ * @brief Creates a region without any frame, pages are backed on demand
+ * with region_populate()
+ */
+int region_create_unpopulated(size_t nr_frames, int prot, region_t** result);
+
+/**
+ * @brief Backs the index-th page of a region with a zeroed frame, unless
+ * it is already backed
+ *
+ * @param frame set to the frame backing the page
+ * @return 0 on success \n
+ *		-EINVAL if the region is not backed per page \n
+ *		-ENOMEM if no frame is available
+ */
+int region_populate(region_t* region, size_t index, p_addr_t* frame);
+
+/**
+ * @brief Releases the frame backing the index-th page of a region
+ */
+void region_depopulate(region_t* region, size_t index);
+
+/**
+ * @brief Creates a region backed by the same frames as src, for
+ * copy-on-write
+ *
+ * Each frame gets a reference for the copy, the copy is backed per page.
+ */
+int region_copy_create(const region_t* src, region_t** result);
+
+/**
+ * @brief Backs the index-th page of a region with frame
+ *
+ * The reference on the frame previously backing the page is handed back to
+ * the caller.
+ */
+int region_set_frame(region_t* region, size_t index, p_addr_t frame);
+
+/**
+ * @brief Moves the pages of region from the index-th one on to a new region
+ *
+ * @return 0 on success \n
+ *		-EINVAL if index is not within the region \n
+ *		-ENOTSUP if the region is shared \n
+ *		-ENOMEM if the new region cannot be allocated
+ */
+int region_split(region_t* region, size_t index, region_t** result);
+
+/**
+ * @brief Adds nr_frames pages, not populated, in front of the region
+ */
+int region_grow_down(region_t* region, size_t nr_frames);
+
+/**
+ * @brief Adds nr_frames pages, not populated, at the end of the region
+ *
+ * @return 0 on success \n
+ *		-ENOTSUP if the region is shared \n
+ *		-ENOMEM if the frame array cannot be reallocated
+ */
+int region_grow_up(region_t* region, size_t nr_frames);
+
+/**
+ * @brief Appends the pages of next to region
+ *
+ * next is left empty, its frames belong to region.
+ *
+ * @return 0 on success \n
+ *		-ENOTSUP if either region is shared \n
+ *		-ENOMEM if the frame array cannot be reallocated
+ */
+int region_merge(region_t* region, region_t* next);
+
+/**
+ * @brief Returns the frame backing the index-th page of the region
+ */
+p_addr_t region_get_frame(const region_t* region, size_t index);
 
 void region_unref(region_t* region);
 
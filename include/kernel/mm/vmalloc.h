@@ -0,0 +1,38 @@
+#ifndef _KERNEL_MM_VMALLOC_H_
+#define _KERNEL_MM_VMALLOC_H_
+
+#include <kernel/mm/memory.h>
+#include <kernel/types.h>
+
+#if !defined(VMALLOC_START) || !defined(VMALLOC_END)
+# error "arch/memory.h must define VMALLOC_START and VMALLOC_END"
+#endif
+
+static inline bool is_vmalloc_addr(const void* addr)
+{
+	return ((v_addr_t)addr >= VMALLOC_START && (v_addr_t)addr < VMALLOC_END);
+}
+
+/**
+ * @brief Allocates a virtually contiguous kernel buffer
+ *
+ * The buffer is backed by page frames allocated one by one, so it does not
+ * need a contiguous run of memory in the kernel heap nor in physical memory.
+ * Each buffer is followed by an unmapped guard page.
+ *
+ * @return the page-aligned buffer, NULL on error
+ */
+void* vmalloc(size_t size);
+
+/**
+ * @brief Same as vmalloc(), the buffer being accounted to key in the kmalloc
+ * profiler: a caller, or a tag if tagged
+ */
+void* __vmalloc(size_t size, const void* key, bool tagged);
+
+/**
+ * @brief Frees a buffer allocated by vmalloc()
+ */
+void vfree(void* addr);
+
+#endif
@@ -7,6 +7,7 @@
 #include <kernel/mm/vm.h>
 #include <libk/bits.h>
 #include <libk/list.h>
+#include <libk/rbtree.h>
 #include <libk/refcount.h>
 
 /*
@@ -21,6 +22,23 @@
  * mapping flags
  */
 #define VMM_MAP_GROWSDOW	BIT(1)
+#define VMM_MAP_POPULATE	BIT(2) // back every page at creation
+#define VMM_MAP_SHARED		BIT(3) // shared with the children, not copied
+#define VMM_MAP_RDONLY		BIT(4) // write access can never be granted
+
+/*
+ * VMM_MAP_GROWSDOW mappings (stacks) grow on faults below them, up to
+ * VMM_STACK_LIMIT bytes, while VMM_STACK_GUARD_GAP bytes stay free under them
+ */
+#ifndef VMM_STACK_LIMIT
+#define VMM_STACK_LIMIT		(8 * 1024 * 1024)
+#endif
+#define VMM_STACK_GUARD_GAP	(16 * PAGE_SIZE)
+
+/*
+ * lowest address user mappings can start at, NULL stays unmapped
+ */
+#define VMM_USER_MIN_ADDR	PAGE_SIZE
 
 /*
  * fault flags
@@ -35,11 +53,15 @@
  */
 struct vmm
 {
-	list_t mappings;
+	list_t mappings; // sorted by start address
+	rb_root_t mapping_tree; // keyed by start address
+	mapping_t* mapping_cache; // last mapping found
 
-	refcount_t refcnt;
+#ifdef MEMORY_PAGE_COLORS
+	unsigned int color; // color of the next frame allocated in this space
+#endif
 
-	list_node_t vmm_list_node;
+	refcount_t refcnt;
 };
 
 struct vmm_interface
@@ -48,20 +70,43 @@ struct vmm_interface
 	void (*destroy)(struct vmm* vmm);
 	void (*switch_to)(struct vmm* vmm);
 	int (*clone_current)(struct vmm* clone);
-	int (*sync_kernel_space)(struct vmm* vmm, void* data);
 
 
 	int (*copy_page)(v_addr_t src, p_addr_t dst);
+	int (*zero_page)(p_addr_t frame);
 	int (*update_kernel_page_prot)(v_addr_t addr, int prot);
 	int (*map_kernel_page)(p_addr_t phys, v_addr_t virt, int prot);
 	int (*unmap_kernel_page)(v_addr_t virt);
+	int (*virt_to_phys)(v_addr_t virt, p_addr_t* phys);
 	int (*update_user_page_prot)(v_addr_t addr, int prot);
 	int (*map_user_page)(p_addr_t phys, v_addr_t virt, int prot);
 	int (*unmap_user_page)(v_addr_t virt);
+
+	void (*invalidate_tlb_page)(v_addr_t virt);
+	void (*flush_user_tlb)(void); // the global (kernel) entries are kept
 };
 
 int vmm_interface_register(const struct vmm_interface* vmm_interface);
 
+/*
+ * TLB invalidation batching: while a batch is open, the invalidations of user
+ * pages are gathered and issued when it is closed, page by page or, above
+ * VMM_TLB_BATCH_PAGES pages, as a flush of the user entries. The batches nest.
+ */
+#define VMM_TLB_BATCH_PAGES 32
+
+void vmm_tlb_batch_begin(void);
+
+void vmm_tlb_batch_end(void);
+
+/**
+ * @brief For the paging code, before invalidating the TLB entry of a user
+ * page
+ *
+ * @return true if the invalidation is deferred to the end of the batch
+ */
+bool vmm_tlb_batch_defer(v_addr_t virt);
+
 
 /**
  * @brief Creates a vmm object
@@ -88,7 +133,21 @@ int vmm_map_kernel_page(p_addr_t phys, v_addr_t virt, int prot);
 
 int vmm_map_kernel_range(p_addr_t phys, v_addr_t virt, size_t size, int prot);
 
-int vmm_sync_kernel_space(void* data);
+int vmm_unmap_kernel_page(v_addr_t virt);
+
+/**
+ * @brief Fills a page frame with zeros
+ */
+int vmm_zero_page(p_addr_t frame);
+
+/**
+ * @brief Looks up the physical address virt is mapped to in the current
+ * address space
+ *
+ * @return 0 on success \n
+ *		-EFAULT if virt is not mapped
+ */
+int vmm_virt_to_phys(v_addr_t virt, p_addr_t* phys);
 
 /**
  * addr must be PAGE_SIZE aligned
@@ -99,14 +158,68 @@ int vmm_destroy_user_mapping(v_addr_t addr);
 
 int vmm_update_user_mapping_prot(v_addr_t addr, int prot);
 
+/**
+ * @brief Creates a user mapping filled with data
+ *
+ * Whole pages of data starting on a page boundary are not copied: their
+ * frames are mapped copy-on-write. The rest of the mapping is zero-filled.
+ *
+ * @param start must be PAGE_SIZE aligned
+ */
+int vmm_create_user_file_mapping(v_addr_t start, size_t size, int prot,
+				 int flags, const void* data, size_t data_size);
+
+/**
+ * @brief Unmaps the pages of [start, start + size[, splitting the mappings
+ * across the bounds
+ *
+ * @param start must be PAGE_SIZE aligned
+ */
+int vmm_unmap_user_range(v_addr_t start, size_t size);
+
+/**
+ * @brief Changes the protection of the pages of [start, start + size[,
+ * splitting the mappings across the bounds
+ *
+ * @param start must be PAGE_SIZE aligned
+ * @return 0 on success \n
+ *		-ENOMEM if part of the range is not mapped \n
+ *		-EACCES if write access is asked for a VMM_MAP_RDONLY mapping
+ */
+int vmm_protect_user_range(v_addr_t start, size_t size, int prot);
+
+/**
+ * @param end last address of the range (inclusive)
+ */
 bool vmm_range_is_free(v_addr_t start, v_addr_t end);
 
+/**
+ * @brief Finds a free range of the current user address space
+ *
+ * The lowest fitting range at or above hint is chosen, or else the lowest
+ * fitting range of the address space.
+ *
+ * @param align power of two, PAGE_SIZE at least
+ * @return 0 on success \n
+ *		-EINVAL on invalid size or alignment \n
+ *		-ENOMEM if no free range is large enough
+ */
+int vmm_find_free_range(size_t size, size_t align, v_addr_t hint,
+			v_addr_t* result);
+
 struct vmm* vmm_get_current_vmm(void);
 
 void vmm_switch_to(struct vmm* vmm);
 
 void vmm_uaccess_setup(void);
 
-v_addr_t vmm_handle_page_fault(v_addr_t fault_addr, int flags);
+/**
+ * @brief Handles a page fault at fault_addr, caused by the instruction at
+ * fault_insn
+ *
+ * @return where to resume execution, or 0 to restart the instruction
+ */
+v_addr_t vmm_handle_page_fault(v_addr_t fault_addr, v_addr_t fault_insn,
+			       int flags);
 
 #endif
@@ -0,0 +1,12 @@
+#ifndef _KERNEL_PAGE_COLORS_BENCH_H_
+#define _KERNEL_PAGE_COLORS_BENCH_H_
+
+/*
+ * Times a cache conflict sensitive walk over buffers of frames allocated like
+ * the pages of a process, and prints it on the terminal (meson option
+ * page_colors_bench). To be compared between builds with and without
+ * page_colors, on hardware: QEMU/TCG does not model caches.
+ */
+void page_colors_bench(void);
+
+#endif
@@ -62,6 +62,11 @@ struct process
 	list_node_t p_child; /**< Chained in process::children */
 };
 
+/**
+ * @brief Creates the object cache for processes
+ */
+int process_cache_init(void);
+
 /**
  * @brief Creates a process object
  *
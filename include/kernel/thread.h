@@ -72,6 +72,11 @@ struct thread
 	wait_queue_entry_t wqe; /**< Chained in wait_queue_t::threads */
 };
 
+/**
+ * @brief Creates the object cache for threads
+ */
+int thread_cache_init(void);
+
 int __kthread_create(char* name, v_addr_t start, struct thread** result);
 int thread_create(v_addr_t start, v_addr_t user_stack, struct thread** result);
 int thread_clone(const struct thread* thread, char* name,
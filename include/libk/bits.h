@@ -3,4 +3,14 @@
 
 #define BIT(n) (1 << (n))
 
+/**
+ * @brief Returns floor(log2(v))
+ *
+ * @note v must not be 0
+ */
+static inline unsigned int ilog2(unsigned long v)
+{
+	return (sizeof(v) * 8 - 1 - __builtin_clzl(v));
+}
+
 #endif
@@ -4,6 +4,7 @@
 #include <kernel/types.h>
 
 void* memcpy(void* dest, const void* src, size_t size);
+void* memmove(void* dest, const void* src, size_t size);
 void* memset(void *s, int c, size_t size);
 int memcmp(const void* s1, const void* s2, size_t size);
 
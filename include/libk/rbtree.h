@@ -0,0 +1,94 @@
+#ifndef _LIBK_RBTREE_H_
+#define _LIBK_RBTREE_H_
+
+#include <kernel/types.h>
+#include <libk/utils.h>
+
+/*
+ * intrusive red-black tree
+ *
+ * The tree does not compare keys: callers walk down from the root to find
+ * where a new node goes, link it with rb_link_node(), then rebalance with
+ * rb_insert_color().
+ */
+
+typedef struct rb_node {
+	struct rb_node* parent;
+	struct rb_node* left;
+	struct rb_node* right;
+	bool red;
+} rb_node_t;
+
+typedef struct rb_root {
+	rb_node_t* node;
+} rb_root_t;
+
+#define RB_ROOT_INIT { .node = NULL }
+
+static inline void rb_root_init(rb_root_t* root)
+{
+	root->node = NULL;
+}
+
+static inline bool rb_empty(const rb_root_t* root)
+{
+	return (root->node == NULL);
+}
+
+#define rb_entry(ptr, type, member) \
+		container_of(ptr, type, member)
+
+/**
+ * @brief Links node as a leaf under parent
+ *
+ * @param link &parent->left, &parent->right, or &root->node if the tree is
+ * empty
+ */
+static inline void rb_link_node(rb_node_t* node, rb_node_t* parent,
+				rb_node_t** link)
+{
+	node->parent = parent;
+	node->left = NULL;
+	node->right = NULL;
+	node->red = true;
+
+	*link = node;
+}
+
+/**
+ * @brief Rebalances the tree after node was linked with rb_link_node()
+ */
+void rb_insert_color(rb_node_t* node, rb_root_t* root);
+
+void rb_erase(rb_node_t* node, rb_root_t* root);
+
+/*
+ * augmented trees: each node caches data computed from its subtree
+ */
+
+/**
+ * @brief Recomputes the data cached in node from node and its children
+ */
+typedef void (*rb_augment_t)(rb_node_t* node);
+
+/**
+ * @brief Updates node and its ancestors, after node's own data changed
+ */
+void rb_propagate(rb_node_t* node, rb_augment_t update);
+
+/**
+ * @brief rb_insert_color() for augmented trees
+ */
+void rb_insert_augmented(rb_node_t* node, rb_root_t* root, rb_augment_t update);
+
+void rb_erase_augmented(rb_node_t* node, rb_root_t* root, rb_augment_t update);
+
+/*
+ * in-order iteration
+ */
+rb_node_t* rb_first(const rb_root_t* root);
+rb_node_t* rb_last(const rb_root_t* root);
+rb_node_t* rb_next(const rb_node_t* node);
+rb_node_t* rb_prev(const rb_node_t* node);
+
+#endif
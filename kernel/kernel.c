@@ -1,3 +1,4 @@
+#include <config.h>
 #include <fs/tty.h>
 #include <fs/vfs.h>
 #include <kernel/arch.h>
@@ -8,7 +9,12 @@
 #include <kernel/kernel.h>
 #include <kernel/kernel_image.h>
 #include <kernel/kheap.h>
+#include <kernel/libk_bench.h>
 #include <kernel/log.h>
+#include <kernel/mm/mapping.h>
+#include <kernel/mm/memory.h>
+#include <kernel/mm/region.h>
+#include <kernel/page_colors_bench.h>
 #include <kernel/process.h>
 #include <kernel/sched/idle.h>
 #include <kernel/sched/reaper.h>
@@ -19,6 +25,14 @@
 
 #include <fs/ramfs/ramfs.h>
 
+static void init_object_caches(void)
+{
+	kassert(region_cache_init() == 0);
+	kassert(mapping_cache_init() == 0);
+	kassert(process_cache_init() == 0);
+	kassert(thread_cache_init() == 0);
+}
+
 static void register_filesystems(void)
 {
 	kassert(ramfs_init_and_register() == 0);
@@ -42,6 +56,14 @@ void kernel_main(void* initrd)
 	terminal_printf("CPU: %s\tRAM: %dMB (%p)\n", cpu->cpu_vendor,
 			(unsigned int)(mem_size >> 20), (void*)mem_size);
 
+#ifdef LIBK_BENCH
+	libk_bench();
+#endif
+#ifdef PAGE_COLORS_BENCH
+	page_colors_bench();
+#endif
+
+	init_object_caches();
 
 	register_filesystems();
 	kassert(vfs_init() == 0);
@@ -53,6 +75,7 @@ void kernel_main(void* initrd)
 	sched_init();
 	reaper_init();
 	idle_init();
+	kassert(memory_deferred_init_start() == 0);
 	kassert(init_process_init("/init") == 0); // create init process first (pid 1)
 
 	sched_start();
@@ -46,19 +46,27 @@ size_t kheap_init(v_addr_t start)
 size_t kheap_sbrk(size_t increment)
 {
 	size_t pages = page_align_up(increment) / PAGE_SIZE;
-	size_t i;
+	size_t i = 0;
 	int err = 0;
 
-	for (i = 0; i < pages && !err; ++i) {
-		p_addr_t frame = memory_page_frame_alloc();
-		if (!frame) {
+	while (i < pages && !err) {
+		unsigned int order;
+		p_addr_t frames = memory_page_frames_alloc_max(pages - i, &order);
+		if (!frames) {
 			err = -ENOMEM;
 		}
 		else {
-			err = vmm_map_kernel_page(frame, kheap_end,
-						  VMM_PROT_WRITE);
-			if (!err)
-				kheap_end += PAGE_SIZE;
+			size_t size = PAGE_SIZE << order;
+
+			err = vmm_map_kernel_range(frames, kheap_end, size,
+						   VMM_PROT_WRITE);
+			if (!err) {
+				kheap_end += size;
+				i += (1 << order);
+			}
+			else {
+				memory_page_frames_free(frames, order);
+			}
 		}
 	}
 
@@ -68,6 +76,27 @@ size_t kheap_sbrk(size_t increment)
 	return (i * PAGE_SIZE);
 }
 
+size_t kheap_trim(size_t decrement)
+{
+	const v_addr_t min_end = kheap_start + KHEAP_INITIAL_SIZE;
+	const size_t pages = page_align_down(decrement) / PAGE_SIZE;
+	size_t i;
+
+	for (i = 0; i < pages && kheap_end > min_end; ++i) {
+		v_addr_t page = kheap_end - PAGE_SIZE;
+		p_addr_t frame;
+
+		if (vmm_virt_to_phys(page, &frame) != 0 ||
+		    vmm_unmap_kernel_page(page) != 0)
+			break;
+
+		memory_page_frame_free(frame);
+		kheap_end = page;
+	}
+
+	return (i * PAGE_SIZE);
+}
+
 v_addr_t kheap_get_start(void)
 {
 	return kheap_start;
@@ -1,12 +1,18 @@
 #include <dummyos/compiler.h>
+#include <dummyos/errno.h>
 #include <kernel/interrupt.h>
 #include <kernel/kassert.h>
 #include <kernel/kernel_image.h>
 #include <kernel/kheap.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <kernel/log.h>
+#include <kernel/mm/memory.h>
+#include <kernel/mm/vmalloc.h>
 #include <kernel/panic.h>
+#include <libk/bits.h>
 #include <libk/libk.h>
+#include <libk/list.h>
 #include <libk/utils.h>
 
 #define MAGIC 0xc001b10c
@@ -14,9 +20,31 @@
 // alocations are aligned to a 16-byte boundary
 #define ALIGNMENT 16
 
+// largest request served by a size class, bigger ones get whole pages
+#define SMALL_MAX_SIZE 1024
+
+// give memory back to the system once the free tail of the heap is that large
+#define TRIM_THRESHOLD (128 * 1024)
+// free space kept at the end of the heap after a trim
+#define TRIM_KEEP (32 * 1024)
+
+// kvmalloc() requests larger than that are served by vmalloc()
+#define KVMALLOC_THRESHOLD (4 * PAGE_SIZE)
+
+// allocation sites tracked by the profiler, site 0 gathers the overflow
+#define MAX_SITES 128
+
 /**
  * @brief Memory block header
  *
+ * The heap is a sequence of page-aligned blocks spanning a whole number of
+ * pages. A block either holds one large allocation, right after its header,
+ * or is a slab carved into objects of the same size. Free blocks are linked in
+ * a free list through a list node following their header.
+ *
+ * The size of a block leads to the next one and prev to the previous one, so
+ * that a freed block can be merged with both of its neighbours.
+ *
  * @note Should be 16 bytes on 32-bit systems and 32 bytes on 64-bit systems.
  * This means that if the header is aligned to a 16-byte boundary the
  * associated memory will be too.
@@ -24,112 +52,208 @@
 typedef struct memory_block_header
 {
 	uintptr_t magic;
-	struct memory_block_header* next;
+	struct memory_block_header* prev;
 
 	size_t size;
 	bool used;
+	bool slab;
+	uint8_t site; // allocation site of a large allocation
 } memory_block_header_t;
 
 static_assert(sizeof(memory_block_header_t) % ALIGNMENT == 0,
 	      "sizeof(memory_block_header_t) is not a multiple of ALIGNMENT");
 
-static bool kmalloc_init_done = false;
+/**
+ * @brief Slab, follows the block header
+ */
+struct slab
+{
+	struct kmem_cache* cache;
 
-#ifdef DEBUG
-static void dump(void)
+	void* free; // free objects, linked through kmem_cache::link_offset
+	size_t nr_used;
+
+	list_node_t s_list; // in kmem_cache::partial while free != NULL
+
+	uint8_t sites[]; // allocation site of each object, if tracked
+};
+
+#define SIZE_CLASS(sz) \
+	{ .name = "kmalloc-" #sz, .obj_size = sz, .track_sites = true }
+
+static struct kmem_cache size_classes[] = {
+	SIZE_CLASS(16), SIZE_CLASS(32), SIZE_CLASS(48), SIZE_CLASS(64),
+	SIZE_CLASS(96), SIZE_CLASS(128), SIZE_CLASS(192), SIZE_CLASS(256),
+	SIZE_CLASS(384), SIZE_CLASS(512), SIZE_CLASS(768), SIZE_CLASS(1024),
+};
+
+static_assert(SMALL_MAX_SIZE == 1024, "SMALL_MAX_SIZE is the last size class");
+
+// maps (size + ALIGNMENT - 1) / ALIGNMENT to a size class index
+static uint8_t size_to_class[SMALL_MAX_SIZE / ALIGNMENT + 1];
+
+static LIST_DEFINE(free_blocks);
+static memory_block_header_t* last_block;
+
+static LIST_DEFINE(caches);
+
+/**
+ * @brief Allocation site
+ *
+ * Identified either by the address of the caller of kmalloc() or by the tag
+ * given to kmalloc_tagged().
+ */
+struct site
 {
-	memory_block_header_t* block;
+	const void* key;
+	bool tagged;
 
-	for (block = (memory_block_header_t*)kheap_get_start();
-	     block;
-	     block = block->next)
-	{
-		log_i_printf("[%p: 0x%x bytes %s] ", block, block->size,
-			     (block->used) ? "used" : "free");
-	}
-	log_i_putchar('\n');
-}
-#endif
+	size_t live_bytes;
+	size_t nr_allocs;
+	size_t nr_frees;
+};
+
+static struct site sites[MAX_SITES];
+static size_t histogram[KMALLOC_HISTOGRAM_BUCKETS];
+
+static bool kmalloc_init_done = false;
 
 static inline void make_memory_block(memory_block_header_t* ptr,
-				     memory_block_header_t* next,
+				     memory_block_header_t* prev,
 				     size_t size,
 				     bool used)
 {
 	ptr->magic = MAGIC;
-	ptr->next = next;
+	ptr->prev = prev;
 	ptr->size = size;
 	ptr->used = used;
+	ptr->slab = false;
 }
 
 static inline memory_block_header_t* next_block(memory_block_header_t* block)
 {
-	return (memory_block_header_t*)((int8_t*)block + block->size);
+	v_addr_t next = (v_addr_t)block + block->size;
+
+	return (next < kheap_get_end()) ? (memory_block_header_t*)next : NULL;
 }
 
-void kmalloc_init(v_addr_t kheap_start, size_t kheap_size)
+static inline list_node_t* block_free_node(memory_block_header_t* block)
 {
-	kassert(is_aligned(kheap_start, ALIGNMENT));
-
-	memory_block_header_t* kheap = (memory_block_header_t*)kheap_start;
-	make_memory_block(kheap, NULL, kheap_size, false);
+	return (list_node_t*)(block + 1);
+}
 
-	kmalloc_init_done = true;
+static inline memory_block_header_t* free_node_to_block(list_node_t* node)
+{
+	return (memory_block_header_t*)node - 1;
 }
 
-void* kmalloc(size_t size)
+#ifdef DEBUG
+static void dump(void)
 {
 	memory_block_header_t* block;
 
-	size = align_up(size + sizeof(memory_block_header_t), ALIGNMENT);
+	for (block = (memory_block_header_t*)kheap_get_start();
+	     block;
+	     block = next_block(block))
+	{
+		if (!block->used)
+			log_i_printf("[%p: 0x%x bytes free] ", block, block->size);
+		else if (block->slab)
+			log_i_printf("[%p: %s] ", block,
+				     ((struct slab*)(block + 1))->cache->name);
+		else
+			log_i_printf("[%p: 0x%x bytes used] ", block, block->size);
+	}
+	log_i_putchar('\n');
+}
+#endif
 
-	irq_disable();
+/*
+ * page layer: first-fit over the free page-aligned blocks
+ */
 
-	// find a free block
-	block = (memory_block_header_t*)kheap_get_start();
-	while (block->next && (block->size < size || block->used))
-		block = block->next;
+/**
+ * @brief Grows the heap so that the last block is a free block of at least
+ * size bytes
+ */
+static memory_block_header_t* heap_grow(size_t size)
+{
+	memory_block_header_t* last = last_block;
+	size_t increment;
 
-	// out of memory ; try to sbrk()
-	if (block->size < size || block->used) {
-		size_t increment = kheap_sbrk(size);
-		if (increment == 0) {
-			block = NULL;
-			goto end;
-		}
+	if (!last->used) {
+		increment = kheap_sbrk(size - last->size);
+		last->size += increment;
+
+		return (last->size >= size) ? last : NULL;
+	}
+
+	increment = kheap_sbrk(size);
+	if (increment == 0)
+		return NULL;
+
+	memory_block_header_t* new = (memory_block_header_t*)((int8_t*)last +
+							      last->size);
+	make_memory_block(new, last, increment, false);
+	list_push_front(&free_blocks, block_free_node(new));
+	last_block = new;
+
+	return (new->size >= size) ? new : NULL;
+}
+
+/**
+ * @brief Gives the free pages at the end of the heap back to the system
+ */
+static void heap_trim(memory_block_header_t* last)
+{
+	if (last->used || last->size < TRIM_THRESHOLD)
+		return;
+
+	last->size -= kheap_trim(last->size - TRIM_KEEP);
+}
 
-		if (block->used) {
-			memory_block_header_t* new = next_block(block);
-			make_memory_block(new, NULL, increment, false);
+static memory_block_header_t* block_alloc(size_t size)
+{
+	memory_block_header_t* block = NULL;
+	list_node_t* it;
 
-			block->next = new;
+	irq_disable();
 
-			block = new;
-		} else {
-			block->size += increment;
+	list_foreach(&free_blocks, it) {
+		memory_block_header_t* b = free_node_to_block(it);
+		if (b->size >= size) {
+			block = b;
+			break;
 		}
 	}
 
-	// sbrk() failed/couldn't allocate enough
-	if (block->size < size) {
-		block = NULL;
-		goto end;
+	// out of memory ; try to sbrk()
+	if (!block) {
+		block = heap_grow(size);
+		if (!block)
+			goto end;
 	}
 
-	// is the block large enough to be split?
-	if (block->size > size * 2) {
-		size_t orig_size = block->size;
+	list_erase(block_free_node(block));
 
+	// blocks are multiples of PAGE_SIZE: split off any remainder
+	if (block->size > size) {
+		memory_block_header_t* rest =
+			(memory_block_header_t*)((int8_t*)block + size);
+		make_memory_block(rest, block, block->size - size, false);
 		block->size = size;
-		memory_block_header_t* second_part = next_block(block);
-		make_memory_block(second_part, block->next, orig_size - size, false);
 
-		block->next = second_part;
+		memory_block_header_t* next = next_block(rest);
+		if (next)
+			next->prev = rest;
+		else
+			last_block = rest;
+
+		list_push_front(&free_blocks, block_free_node(rest));
 	}
 
 	block->used = true;
-
-	block = block + 1; // point to data
+	block->slab = false;
 
 #ifdef DEBUG
 	dump();
@@ -141,15 +265,594 @@ end:
 	return block;
 }
 
+static void block_free(memory_block_header_t* block)
+{
+	memory_block_header_t* next;
+	memory_block_header_t* prev;
+
+	irq_disable();
+
+	block->used = false;
+	block->slab = false;
+
+	next = next_block(block);
+	if (next && !next->used) {
+		list_erase(block_free_node(next));
+		block->size += next->size;
+		next->magic = 0;
+	}
+
+	prev = block->prev;
+	if (prev && !prev->used) {
+		prev->size += block->size;
+		block->magic = 0;
+		block = prev;
+	}
+	else {
+		list_push_front(&free_blocks, block_free_node(block));
+	}
+
+	next = next_block(block);
+	if (next) {
+		next->prev = block;
+	}
+	else {
+		last_block = block;
+		heap_trim(block);
+	}
+
+#ifdef DEBUG
+	dump();
+#endif
+
+	irq_enable();
+}
+
+/*
+ * slabs
+ */
+static inline struct slab* block_to_slab(memory_block_header_t* block)
+{
+	return (struct slab*)(block + 1);
+}
+
+static inline memory_block_header_t* slab_to_block(struct slab* slab)
+{
+	return (memory_block_header_t*)slab - 1;
+}
+
+static inline void** obj_link(const struct kmem_cache* cache, void* obj)
+{
+	return (void**)((int8_t*)obj + cache->link_offset);
+}
+
+static inline v_addr_t slab_objs(struct slab* slab)
+{
+	return (v_addr_t)slab_to_block(slab) + slab->cache->objs_offset;
+}
+
+/**
+ * @brief Returns the index of obj in its slab, -1 if obj is not the start of
+ * an object
+ */
+static ssize_t slab_obj_index(struct slab* slab, void* obj)
+{
+	const v_addr_t objs = slab_objs(slab);
+	const size_t size = slab->cache->size;
+
+	if ((v_addr_t)obj < objs || ((v_addr_t)obj - objs) % size)
+		return -1;
+
+	return ((v_addr_t)obj - objs) / size;
+}
+
+static struct slab* slab_create(struct kmem_cache* cache)
+{
+	memory_block_header_t* block;
+	struct slab* slab;
+	int8_t* obj;
+
+	block = block_alloc(PAGE_SIZE);
+	if (!block)
+		return NULL;
+
+	block->slab = true;
+
+	slab = block_to_slab(block);
+	slab->cache = cache;
+	slab->free = NULL;
+	slab->nr_used = 0;
+	list_node_init(&slab->s_list);
+
+	// build the free list backwards so that objects are handed out in
+	// ascending order
+	obj = (int8_t*)slab_objs(slab) + (cache->objs_per_slab - 1) * cache->size;
+	for (size_t i = 0; i < cache->objs_per_slab; ++i, obj -= cache->size) {
+		if (cache->ctor)
+			cache->ctor(obj);
+		*obj_link(cache, obj) = slab->free;
+		slab->free = obj;
+	}
+
+	return slab;
+}
+
+static inline void* slab_pop(struct kmem_cache* cache, struct slab* slab)
+{
+	void* obj = slab->free;
+
+	slab->free = *obj_link(cache, obj);
+	++slab->nr_used;
+	if (!slab->free)
+		list_erase(&slab->s_list);
+
+	++cache->stats.nr_allocs;
+	++cache->stats.nr_active_objs;
+
+	return obj;
+}
+
+static void slab_free(struct slab* slab, void* obj)
+{
+	struct kmem_cache* cache = slab->cache;
+	bool release = false;
+
+	irq_disable();
+
+	*obj_link(cache, obj) = slab->free;
+	slab->free = obj;
+	--slab->nr_used;
+
+	++cache->stats.nr_frees;
+	--cache->stats.nr_active_objs;
+
+	if (!list_node_chained(&slab->s_list)) {
+		list_push_front(&cache->partial, &slab->s_list);
+	}
+	else if (slab->nr_used == 0 &&
+		 list_front(&cache->partial) != list_back(&cache->partial))
+	{
+		// keep a single empty slab around per cache
+		list_erase(&slab->s_list);
+		--cache->stats.nr_slabs;
+		release = true;
+	}
+
+	irq_enable();
+
+	if (release)
+		block_free(slab_to_block(slab));
+}
+
+static int kmem_cache_setup(struct kmem_cache* cache)
+{
+	const size_t hdr_size = sizeof(memory_block_header_t) +
+		sizeof(struct slab);
+	size_t nr_objs;
+
+	if (cache->ctor) {
+		// the link must not clobber the constructed object
+		cache->link_offset = align_up(cache->obj_size, sizeof(void*));
+		cache->size = align_up(cache->link_offset + sizeof(void*),
+				       ALIGNMENT);
+	}
+	else {
+		cache->link_offset = 0;
+		cache->size = align_up(cache->obj_size, ALIGNMENT);
+	}
+
+	if (cache->obj_size == 0 ||
+	    align_up(hdr_size, ALIGNMENT) + cache->size > PAGE_SIZE)
+		return -EINVAL;
+
+	// tracked caches store a site index per object after the slab header
+	if (cache->track_sites) {
+		nr_objs = (PAGE_SIZE - hdr_size) / (cache->size + 1);
+		cache->objs_offset = align_up(hdr_size + nr_objs, ALIGNMENT);
+	}
+	else {
+		cache->objs_offset = align_up(hdr_size, ALIGNMENT);
+		nr_objs = (PAGE_SIZE - cache->objs_offset) / cache->size;
+	}
+	while (cache->objs_offset + nr_objs * cache->size > PAGE_SIZE)
+		--nr_objs;
+	if (nr_objs == 0)
+		return -EINVAL;
+
+	cache->objs_per_slab = nr_objs;
+	list_init(&cache->partial);
+	memset(&cache->stats, 0, sizeof(struct kmem_cache_stats));
+
+	irq_disable();
+	list_push_back(&caches, &cache->c_list);
+	irq_enable();
+
+	return 0;
+}
+
+int kmem_cache_create(const char* name, size_t size, kmem_cache_ctor_t ctor,
+		      struct kmem_cache** result)
+{
+	struct kmem_cache* cache;
+	int err;
+
+	cache = kmalloc(sizeof(struct kmem_cache));
+	if (!cache)
+		return -ENOMEM;
+
+	cache->name = name;
+	cache->obj_size = size;
+	cache->ctor = ctor;
+	cache->track_sites = false;
+
+	err = kmem_cache_setup(cache);
+	if (err) {
+		kfree(cache);
+		cache = NULL;
+	}
+
+	*result = cache;
+
+	return err;
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache)
+{
+	struct slab* slab;
+	void* obj = NULL;
+
+	irq_disable();
+	if (!list_empty(&cache->partial)) {
+		slab = list_entry(list_front(&cache->partial), struct slab,
+				  s_list);
+		obj = slab_pop(cache, slab);
+	}
+	irq_enable();
+
+	if (obj)
+		return obj;
+
+	slab = slab_create(cache);
+	if (!slab)
+		return NULL;
+
+	irq_disable();
+	list_push_front(&cache->partial, &slab->s_list);
+	++cache->stats.nr_slabs;
+	obj = slab_pop(cache, slab);
+	irq_enable();
+
+	return obj;
+}
+
+/**
+ * @brief Returns the slab holding an object, NULL if the object does not
+ * belong to a slab
+ */
+static struct slab* obj_to_slab(void* obj)
+{
+	memory_block_header_t* block =
+		(memory_block_header_t*)page_align_down((v_addr_t)obj);
+
+	if (block->magic != MAGIC || !block->used || !block->slab)
+		return NULL;
+
+	return block_to_slab(block);
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* obj)
+{
+	struct slab* slab;
+
+	if (!obj)
+		return;
+
+	slab = obj_to_slab(obj);
+	if (!slab || slab->cache != cache || slab_obj_index(slab, obj) < 0) {
+		log_i_printf("Trying to free an object (%p) not allocated from "
+			     "%s\n", obj, cache->name);
+		return;
+	}
+
+	slab_free(slab, obj);
+}
+
+void kmem_cache_statistics(const struct kmem_cache* cache,
+			   struct kmem_cache_stats* stats)
+{
+	irq_disable();
+	*stats = cache->stats;
+	irq_enable();
+}
+
+/*
+ * profiler
+ */
+static size_t site_hash(const void* key, bool tagged)
+{
+	size_t hash = 5381;
+
+	if (!tagged)
+		return ((uintptr_t)key >> 2);
+
+	for (const char* c = key; *c; ++c)
+		hash = hash * 33 + *c;
+
+	return hash;
+}
+
+static bool site_match(const struct site* site, const void* key, bool tagged)
+{
+	if (site->tagged != tagged)
+		return false;
+
+	return (tagged) ? strcmp(site->key, key) == 0 : site->key == key;
+}
+
+/**
+ * @brief Finds or registers an allocation site
+ *
+ * @return the index of the site, 0 if the table is full
+ */
+static uint8_t site_lookup(const void* key, bool tagged)
+{
+	const size_t hash = site_hash(key, tagged);
+
+	for (size_t i = 0; i < MAX_SITES - 1; ++i) {
+		const size_t idx = 1 + (hash + i) % (MAX_SITES - 1);
+		struct site* site = &sites[idx];
+
+		if (!site->key) {
+			site->key = key;
+			site->tagged = tagged;
+			return idx;
+		}
+		if (site_match(site, key, tagged))
+			return idx;
+	}
+
+	return 0;
+}
+
+static inline size_t histogram_bucket(size_t size)
+{
+	if (size <= 16)
+		return 0;
+
+	const size_t bucket = ilog2(size - 1) - 3;
+
+	return (bucket < KMALLOC_HISTOGRAM_BUCKETS) ?
+		bucket : KMALLOC_HISTOGRAM_BUCKETS - 1;
+}
+
+static uint8_t site_account_alloc(const void* key, bool tagged, size_t size,
+				  size_t bytes)
+{
+	uint8_t idx;
+
+	irq_disable();
+
+	idx = site_lookup(key, tagged);
+	sites[idx].live_bytes += bytes;
+	++sites[idx].nr_allocs;
+	++histogram[histogram_bucket(size)];
+
+	irq_enable();
+
+	return idx;
+}
+
+static void site_account_free(uint8_t idx, size_t bytes)
+{
+	irq_disable();
+
+	sites[idx].live_bytes -= bytes;
+	++sites[idx].nr_frees;
+
+	irq_enable();
+}
+
+uint8_t kmalloc_profile_alloc(const void* key, bool tagged, size_t size,
+			      size_t bytes)
+{
+	return site_account_alloc(key, tagged, size, bytes);
+}
+
+void kmalloc_profile_free(uint8_t site, size_t bytes)
+{
+	site_account_free(site, bytes);
+}
+
+void kmalloc_statistics(struct kmalloc_stats* stats)
+{
+	list_node_t* it;
+
+	memset(stats, 0, sizeof(struct kmalloc_stats));
+
+	irq_disable();
+
+	stats->heap_size = kheap_get_end() - kheap_get_start();
+
+	list_foreach(&free_blocks, it) {
+		const memory_block_header_t* block = free_node_to_block(it);
+
+		stats->free_bytes += block->size;
+		if (block->size > stats->largest_free_block)
+			stats->largest_free_block = block->size;
+	}
+
+	memcpy(stats->histogram, histogram, sizeof(histogram));
+
+	irq_enable();
+}
+
+size_t kmalloc_site_statistics(struct kmalloc_site_stats* result, size_t n)
+{
+	size_t count = 0;
+
+	irq_disable();
+
+	for (size_t i = 0; i < MAX_SITES && count < n; ++i) {
+		const struct site* site = &sites[i];
+
+		if (site->nr_allocs == 0)
+			continue;
+
+		result[count].caller = (site->tagged) ? NULL : site->key;
+		result[count].tag = (site->tagged) ? site->key : NULL;
+		result[count].live_bytes = site->live_bytes;
+		result[count].nr_allocs = site->nr_allocs;
+		result[count].nr_frees = site->nr_frees;
+		++count;
+	}
+
+	irq_enable();
+
+	return count;
+}
+
+void kmalloc_dump_statistics(void)
+{
+	struct kmalloc_stats stats;
+	list_node_t* it;
+
+	kmalloc_statistics(&stats);
+
+	log_i_printf("kmalloc: heap %u bytes, free %u bytes, largest free block "
+		     "%u bytes (%u%%)\n",
+		     (unsigned int)stats.heap_size,
+		     (unsigned int)stats.free_bytes,
+		     (unsigned int)stats.largest_free_block,
+		     (stats.free_bytes) ?
+		     (unsigned int)((uint64_t)stats.largest_free_block * 100 /
+				    stats.free_bytes) : 100);
+
+	log_i_puts("kmalloc: sizes:");
+	for (size_t i = 0; i < KMALLOC_HISTOGRAM_BUCKETS - 1; ++i) {
+		log_i_printf(" <=%u:%u", (unsigned int)(16 << i),
+			     (unsigned int)stats.histogram[i]);
+	}
+	log_i_printf(" >%u:%u\n",
+		     (unsigned int)(16 << (KMALLOC_HISTOGRAM_BUCKETS - 2)),
+		     (unsigned int)stats.histogram[KMALLOC_HISTOGRAM_BUCKETS - 1]);
+
+	for (size_t i = 0; i < MAX_SITES; ++i) {
+		struct site site;
+
+		irq_disable();
+		site = sites[i];
+		irq_enable();
+
+		if (site.nr_allocs == 0)
+			continue;
+
+		if (site.tagged)
+			log_i_printf("kmalloc: [%s]", (const char*)site.key);
+		else if (site.key)
+			log_i_printf("kmalloc: [%p]", site.key);
+		else
+			log_i_puts("kmalloc: [other]");
+		log_i_printf(" live %u bytes, %u allocs, %u frees\n",
+			     (unsigned int)site.live_bytes,
+			     (unsigned int)site.nr_allocs,
+			     (unsigned int)site.nr_frees);
+	}
+
+	list_foreach(&caches, it) {
+		const struct kmem_cache* cache =
+			list_entry(it, struct kmem_cache, c_list);
+		struct kmem_cache_stats cstats;
+
+		kmem_cache_statistics(cache, &cstats);
+		log_i_printf("kmem_cache: %s: %u active objs, %u slabs, "
+			     "%u allocs, %u frees\n", cache->name,
+			     (unsigned int)cstats.nr_active_objs,
+			     (unsigned int)cstats.nr_slabs,
+			     (unsigned int)cstats.nr_allocs,
+			     (unsigned int)cstats.nr_frees);
+	}
+}
+
+void kmalloc_init(v_addr_t kheap_start, size_t kheap_size)
+{
+	kassert(page_is_aligned(kheap_start));
+
+	memory_block_header_t* kheap = (memory_block_header_t*)kheap_start;
+	make_memory_block(kheap, NULL, kheap_size, false);
+	list_push_front(&free_blocks, block_free_node(kheap));
+	last_block = kheap;
+
+	uint8_t class_idx = 0;
+	for (size_t i = 0; i < ARRAY_SIZE(size_to_class); ++i) {
+		while (i * ALIGNMENT > size_classes[class_idx].obj_size)
+			++class_idx;
+		size_to_class[i] = class_idx;
+	}
+
+	for (size_t i = 0; i < ARRAY_SIZE(size_classes); ++i)
+		kassert(kmem_cache_setup(&size_classes[i]) == 0);
+
+	kmalloc_init_done = true;
+}
+
+static void* __kmalloc(size_t size, const void* key, bool tagged)
+{
+	memory_block_header_t* block;
+	size_t bytes;
+
+	if (size <= SMALL_MAX_SIZE) {
+		struct kmem_cache* cache = &size_classes[size_to_class[
+				(size + ALIGNMENT - 1) / ALIGNMENT]];
+		void* obj = kmem_cache_alloc(cache);
+		if (obj) {
+			struct slab* slab = obj_to_slab(obj);
+			slab->sites[slab_obj_index(slab, obj)] =
+				site_account_alloc(key, tagged, size, cache->size);
+		}
+
+		return obj;
+	}
+
+	if (size > SIZE_MAX - PAGE_SIZE - sizeof(memory_block_header_t))
+		return NULL;
+
+	bytes = page_align_up(size + sizeof(memory_block_header_t));
+
+	/*
+	 * The header would take a page of its own (page multiples, like kernel
+	 * stacks): whole pages from vmalloc() instead, without inline header.
+	 */
+	if (bytes > page_align_up(size))
+		return __vmalloc(size, key, tagged);
+
+	block = block_alloc(bytes);
+	if (!block)
+		return NULL;
+
+	block->site = site_account_alloc(key, tagged, size, bytes);
+
+	return block + 1;
+}
+
+void* kmalloc(size_t size)
+{
+	return __kmalloc(size, __builtin_return_address(0), false);
+}
+
+void* kmalloc_tagged(size_t size, const char* tag)
+{
+	return __kmalloc(size, tag, true);
+}
+
 void* kcalloc(size_t count, size_t size)
 {
 	void* mem;
 
-	if (SIZE_MAX / count < size) // overflow
+	if (count && SIZE_MAX / count < size) // overflow
 		return NULL;
 
 	size = count * size;
-	mem = kmalloc(size);
+	mem = __kmalloc(size, __builtin_return_address(0), false);
 	if (mem)
 		memset(mem, 0, size);
 
@@ -157,11 +860,58 @@ void* kcalloc(size_t count, size_t size)
 
 }
 
+static void* __kvmalloc(size_t size, const void* key, bool tagged)
+{
+	if (size > KVMALLOC_THRESHOLD)
+		return __vmalloc(size, key, tagged);
+
+	return __kmalloc(size, key, tagged);
+}
+
+void* kvmalloc(size_t size)
+{
+	return __kvmalloc(size, __builtin_return_address(0), false);
+}
+
+void* kvmalloc_tagged(size_t size, const char* tag)
+{
+	return __kvmalloc(size, tag, true);
+}
+
+void* kvcalloc(size_t count, size_t size)
+{
+	void* mem;
+
+	if (count && SIZE_MAX / count < size) // overflow
+		return NULL;
+
+	size = count * size;
+	mem = __kvmalloc(size, __builtin_return_address(0), false);
+	if (mem)
+		memset(mem, 0, size);
+
+	return mem;
+}
+
+void kvfree(void* ptr)
+{
+	if (is_vmalloc_addr(ptr))
+		vfree(ptr);
+	else
+		kfree(ptr);
+}
+
 void kfree(void* ptr)
 {
 	if (!ptr)
 		return;
 
+	// large allocations without header
+	if (is_vmalloc_addr(ptr)) {
+		vfree(ptr);
+		return;
+	}
+
 	if (!is_aligned((v_addr_t)ptr, ALIGNMENT)) {
 		log_i_printf("Trying to free invalid address! "
 			     "%p is not %d-byte aligned.\n",
@@ -169,35 +919,40 @@ void kfree(void* ptr)
 		return;
 	}
 
-	irq_disable();
-
-	memory_block_header_t* block = (memory_block_header_t*)ptr - 1;
+	memory_block_header_t* block =
+		(memory_block_header_t*)page_align_down((v_addr_t)ptr);
 
 	if (block->magic != MAGIC) {
 		log_i_printf("Trying to free an invalid block! "
 			     "Invalid magic number (%p)\n", (void*)block);
-		goto end;
+		return;
 	}
 	if (!block->used) {
 		log_i_printf("Trying to free a free block! (%p)\n", (void*)block);
-		goto end;
+		return;
 	}
 
-	memory_block_header_t* next;
-	size_t merge_size = block->size;
-	for (next = block->next; next && !next->used; next = next->next)
-		merge_size += next->size;
-
-	block->next = next;
-	block->size = merge_size;
-	block->used = false;
+	if (block->slab) {
+		struct slab* slab = block_to_slab(block);
+		ssize_t idx = slab_obj_index(slab, ptr);
 
-#ifdef DEBUG
-	dump();
-#endif
+		if (idx < 0) {
+			log_i_printf("Trying to free an invalid object! (%p)\n",
+				     ptr);
+			return;
+		}
 
-end:
-	irq_enable();
+		if (slab->cache->track_sites)
+			site_account_free(slab->sites[idx], slab->cache->size);
+		slab_free(slab, ptr);
+	}
+	else if (ptr != block + 1) {
+		log_i_printf("Trying to free an invalid address! (%p)\n", ptr);
+	}
+	else {
+		site_account_free(block->site, block->size);
+		block_free(block);
+	}
 }
 
 v_addr_t kmalloc_early(size_t size)
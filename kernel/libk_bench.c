@@ -0,0 +1,104 @@
+#include <kernel/cpu.h>
+#include <kernel/libk_bench.h>
+#include <kernel/terminal.h>
+#include <kernel/types.h>
+#include <libk/libk.h>
+#include <libk/utils.h>
+
+#define BENCH_MAX_SIZE		16384
+#define BENCH_BYTES_PER_RUN	(1024 * 1024)
+
+static uint8_t bench_src[BENCH_MAX_SIZE + 2 * sizeof(long)];
+static uint8_t bench_dst[BENCH_MAX_SIZE + 2 * sizeof(long)];
+
+// keeps the calls from being optimized out
+static volatile uintptr_t bench_sink;
+
+enum bench_func
+{
+	BENCH_MEMCPY,
+	BENCH_MEMMOVE,
+	BENCH_MEMSET,
+	BENCH_MEMCMP,
+	BENCH_STRLEN,
+};
+
+static const char* const bench_func_names[] = {
+	[BENCH_MEMCPY] = "memcpy",
+	[BENCH_MEMMOVE] = "memmove",
+	[BENCH_MEMSET] = "memset",
+	[BENCH_MEMCMP] = "memcmp",
+	[BENCH_STRLEN] = "strlen",
+};
+
+static const size_t bench_sizes[] = { 16, 64, 256, 1024, 4096, 16384 };
+
+// destination/source offsets
+static const struct { size_t dst; size_t src; } bench_aligns[] = {
+	{ 0, 0 }, { 1, 1 }, { 0, 3 },
+};
+
+static void bench_call(enum bench_func func, uint8_t* dst, uint8_t* src,
+		       size_t size)
+{
+	switch (func) {
+	case BENCH_MEMCPY:
+		bench_sink = (uintptr_t)memcpy(dst, src, size);
+		break;
+	case BENCH_MEMMOVE:
+		// overlapping, backward copy
+		bench_sink = (uintptr_t)memmove(src + 1, src, size - 1);
+		break;
+	case BENCH_MEMSET:
+		bench_sink = (uintptr_t)memset(dst, 0x5a, size);
+		break;
+	case BENCH_MEMCMP:
+		bench_sink = memcmp(dst, src, size);
+		break;
+	case BENCH_STRLEN:
+		bench_sink = strlen((const char*)src);
+		break;
+	}
+}
+
+static void bench_run(enum bench_func func, size_t size, size_t dst_off,
+		      size_t src_off)
+{
+	uint8_t* dst = bench_dst + dst_off;
+	uint8_t* src = bench_src + src_off;
+	size_t iterations = BENCH_BYTES_PER_RUN / size;
+
+	memset(src, 'a', size);
+	src[size - 1] = '\0';
+	memcpy(dst, src, size);
+
+	// warm up the caches
+	bench_call(func, dst, src, size);
+
+	uint32_t start = cpu_cycles();
+	for (size_t i = 0; i < iterations; ++i)
+		bench_call(func, dst, src, size);
+	uint32_t cycles = cpu_cycles() - start;
+
+	// bytes per cycle, 2 decimal places
+	uint32_t rate = (cycles > 0) ? (iterations * size * 100) / cycles : 0;
+
+	terminal_printf("%s\t%u\t%u/%u\t%u.%u%u B/cycle\n",
+			bench_func_names[func], (unsigned int)size,
+			(unsigned int)dst_off, (unsigned int)src_off,
+			rate / 100, (rate / 10) % 10, rate % 10);
+}
+
+void libk_bench(void)
+{
+	terminal_puts("libk benchmark: function\tsize\tdst/src offsets\trate\n");
+
+	for (size_t f = 0; f < ARRAY_SIZE(bench_func_names); ++f) {
+		for (size_t s = 0; s < ARRAY_SIZE(bench_sizes); ++s) {
+			for (size_t a = 0; a < ARRAY_SIZE(bench_aligns); ++a) {
+				bench_run(f, bench_sizes[s], bench_aligns[a].dst,
+					  bench_aligns[a].src);
+			}
+		}
+	}
+}
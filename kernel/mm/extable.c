@@ -0,0 +1,18 @@
+#include <kernel/mm/extable.h>
+
+// see the linker scripts
+extern const struct extable_entry __ex_table_start[];
+extern const struct extable_entry __ex_table_end[];
+
+v_addr_t extable_search(v_addr_t insn)
+{
+	// a handful of entries, in the uaccess primitives: no need to sort them
+	for (const struct extable_entry* e = __ex_table_start;
+	     e < __ex_table_end; ++e)
+	{
+		if (e->insn == insn)
+			return e->fixup;
+	}
+
+	return 0;
+}
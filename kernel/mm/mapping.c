@@ -1,8 +1,17 @@
 #include <dummyos/errno.h>
-#include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <kernel/mm/mapping.h>
+#include <kernel/mm/vmm.h>
 #include <libk/libk.h>
 
+static struct kmem_cache* mapping_cache;
+
+int mapping_cache_init(void)
+{
+	return kmem_cache_create("mapping", sizeof(mapping_t), NULL,
+				 &mapping_cache);
+}
+
 void mapping_reset(mapping_t* mapping)
 {
 	region_unref(mapping->region);
@@ -13,7 +22,7 @@ void mapping_reset(mapping_t* mapping)
 void mapping_destroy(mapping_t* mapping)
 {
 	mapping_reset(mapping);
-	kfree(mapping);
+	kmem_cache_free(mapping_cache, mapping);
 }
 
 static int mapping_init_from_range(mapping_t* mapping, v_addr_t mstart,
@@ -40,13 +49,35 @@ int mapping_create_from_range(v_addr_t mstart, p_addr_t pstart, size_t size,
 	mapping_t* mapping;
 	int err;
 
-	mapping = kmalloc(sizeof(mapping_t));
+	mapping = kmem_cache_alloc(mapping_cache);
 	if (!mapping)
 		return -ENOMEM;
 
 	err = mapping_init_from_range(mapping, mstart, pstart, size, prot, flags);
 	if (err) {
-		kfree(mapping);
+		kmem_cache_free(mapping_cache, mapping);
+		mapping = NULL;
+	}
+
+	*result = mapping;
+
+	return err;
+}
+
+int mapping_create_from_region(v_addr_t start, region_t* region, int flags,
+			       mapping_t** result)
+{
+	mapping_t* mapping;
+	int err;
+
+	mapping = kmem_cache_alloc(mapping_cache);
+	if (!mapping)
+		return -ENOMEM;
+
+	err = __mapping_init(mapping, region, start,
+			     region->nr_frames * PAGE_SIZE, flags);
+	if (err) {
+		kmem_cache_free(mapping_cache, mapping);
 		mapping = NULL;
 	}
 
@@ -81,7 +112,13 @@ static int mapping_init(mapping_t* mapping, v_addr_t start, size_t size,
 	if (end < start)
 		return -EOVERFLOW;
 
-	err = region_create((end - start) / PAGE_SIZE, prot, &region);
+	// anonymous memory is populated on first touch, unless asked otherwise
+	if (flags & VMM_MAP_POPULATE)
+		err = region_create_zeroed((end - start) / PAGE_SIZE, prot,
+					   &region);
+	else
+		err = region_create_unpopulated((end - start) / PAGE_SIZE, prot,
+						&region);
 	if (!err) {
 		err = __mapping_init(mapping, region, start, size, flags);
 		region_unref(region);
@@ -96,13 +133,13 @@ int mapping_create(v_addr_t start, size_t size, int prot, int flags,
 	mapping_t* mapping;
 	int err;
 
-	mapping = kmalloc(sizeof(mapping_t));
+	mapping = kmem_cache_alloc(mapping_cache);
 	if (!mapping)
 		return -ENOMEM;
 
 	err = mapping_init(mapping, start, size, prot, flags);
 	if (err) {
-		kfree(mapping);
+		kmem_cache_free(mapping_cache, mapping);
 		mapping = NULL;
 	}
 
@@ -114,17 +151,105 @@ int mapping_create(v_addr_t start, size_t size, int prot, int flags,
 int mapping_copy_create(const mapping_t* src, mapping_t** result)
 {
 	mapping_t* mapping;
+	int err;
 
-	mapping = kmalloc(sizeof(mapping_t));
+	mapping = kmem_cache_alloc(mapping_cache);
 	if (!mapping)
 		return -ENOMEM;
 
 	memcpy(mapping, src, sizeof(mapping_t));
 
-	region_ref(mapping->region);
+	if (src->flags & VMM_MAP_SHARED) {
+		region_ref(mapping->region);
+	}
+	else {
+		// the frames are shared, each page is copied on its first write
+		err = region_copy_create(src->region, &mapping->region);
+		if (err) {
+			kmem_cache_free(mapping_cache, mapping);
+			return err;
+		}
+	}
+
 	list_node_init(&mapping->m_list);
 
 	*result = mapping;
 
 	return 0;
 }
+
+int mapping_split(mapping_t* mapping, v_addr_t addr, mapping_t** result)
+{
+	mapping_t* tail;
+	region_t* region;
+	int err;
+
+	if (!page_is_aligned(addr) || addr <= mapping->start ||
+	    !mapping_contains_addr(mapping, addr))
+		return -EINVAL;
+
+	tail = kmem_cache_alloc(mapping_cache);
+	if (!tail)
+		return -ENOMEM;
+
+	err = region_split(mapping->region, (addr - mapping->start) / PAGE_SIZE,
+			   &region);
+	if (err) {
+		kmem_cache_free(mapping_cache, tail);
+		return err;
+	}
+
+	// cannot overflow: the tail ends where mapping did
+	__mapping_init(tail, region, addr, mapping->start + mapping->size - addr,
+		       mapping->flags);
+	region_unref(region);
+
+	mapping->size = addr - mapping->start;
+
+	*result = tail;
+
+	return 0;
+}
+
+bool mapping_can_merge(const mapping_t* mapping, const mapping_t* next)
+{
+	// stacks grow by themselves, shared regions are mapped as a whole
+	const int no_merge = VMM_MAP_GROWSDOW | VMM_MAP_SHARED;
+
+	return (mapping->start + mapping->size == next->start &&
+		mapping->flags == next->flags && !(mapping->flags & no_merge) &&
+		mapping->region->prot == next->region->prot &&
+		region_get_ref(mapping->region) == 1 &&
+		region_get_ref(next->region) == 1);
+}
+
+int mapping_merge(mapping_t* mapping, mapping_t* next)
+{
+	int err;
+
+	if (!mapping_can_merge(mapping, next))
+		return -EINVAL;
+
+	err = region_merge(mapping->region, next->region);
+	if (err)
+		return err;
+
+	mapping->size += next->size;
+	next->size = 0;
+
+	return 0;
+}
+
+int mapping_grow_up(mapping_t* mapping, size_t size)
+{
+	int err;
+
+	if (mapping->start + mapping->size + size < mapping->start)
+		return -EOVERFLOW;
+
+	err = region_grow_up(mapping->region, page_align_up(size) / PAGE_SIZE);
+	if (!err)
+		mapping->size += size;
+
+	return err;
+}
@@ -1,10 +1,14 @@
 #include <dummyos/errno.h>
+#include <kernel/interrupt.h>
 #include <kernel/kassert.h>
 #include <kernel/kernel_image.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kthread.h>
 #include <kernel/log.h>
 #include <kernel/mm/memory.h>
-#include <kernel/page_frame_status.h>
+#include <kernel/mm/vmm.h>
+#include <kernel/sched/sched.h>
+#include <libk/bits.h>
 #include <libk/libk.h>
 #include <libk/list.h>
 
@@ -47,17 +51,60 @@ struct page_frame
 {
 	p_addr_t addr;
 
+	/** order of the free block this frame heads (valid if chained) */
+	unsigned int order;
+
+	/**
+	 * references besides the first one while the frame is allocated, see
+	 * memory_page_frame_ref()
+	 */
+	unsigned int refcnt;
+
+	/** valid entries, while the frame holds a user page table */
+	unsigned int nr_entries;
+
+	/**
+	 * chained in free_areas[order] if the frame heads a free block, or in
+	 * zeroed_frames (order is then PF_ORDER_ZEROED)
+	 */
 	list_node_t pf_list;
 };
 
+#define PF_ORDER_ZEROED (MEMORY_PAGE_FRAMES_MAX_ORDER + 1)
+
 typedef struct pf_list_t
 {
 	list_t list;
 	size_t n;
 } pf_list_t;
 
-static pf_list_t free_page_frames;
-static pf_list_t used_page_frames;
+/*
+ * buddy allocator: free_areas[order] holds the free blocks of
+ * 2^order contiguous page frames, aligned on a 2^order frames boundary
+ */
+static pf_list_t free_areas[MEMORY_PAGE_FRAMES_MAX_ORDER + 1];
+
+/*
+ * free frames already cleared, filled by the idle thread; they do not belong
+ * to the buddy allocator but are counted as free
+ */
+static pf_list_t zeroed_frames;
+
+#ifdef MEMORY_PAGE_COLORS
+#define page_color(addr) (((addr) / PAGE_SIZE) & (MEMORY_PAGE_COLORS - 1))
+
+/*
+ * page coloring: free single frames are kept in one list per color instead of
+ * free_areas[0]
+ */
+static pf_list_t free_frames_by_color[MEMORY_PAGE_COLORS];
+
+/* color of the next single frame allocation, see memory_set_color_cursor() */
+static unsigned int* color_cursor = NULL;
+#endif
+
+static size_t nr_free_page_frames = 0;
+static size_t nr_used_page_frames = 0;
 
 static void memory_pf_list_init(pf_list_t* list)
 {
@@ -67,10 +114,16 @@ static void memory_pf_list_init(pf_list_t* list)
 
 static void memory_pf_list_insert(pf_list_t* list, struct page_frame* pf)
 {
-	list_push_back(&list->list, &pf->pf_list);
+	list_push_front(&list->list, &pf->pf_list);
 	++list->n;
 }
 
+static void memory_pf_list_erase(pf_list_t* list, struct page_frame* pf)
+{
+	list_erase(&pf->pf_list);
+	--list->n;
+}
+
 static p_addr_t memory_base;
 static p_addr_t memory_top;
 
@@ -79,20 +132,112 @@ static p_addr_t memory_top;
 static struct page_frame early_free_frames[MEMORY_EARLY_FRAMES];
 static size_t early_free_frames_size = 0;
 
+static struct page_frame* page_frame_descriptors = NULL;
+
+static inline bool is_early_page_frame(p_addr_t addr)
+{
+	const p_addr_t start = early_free_frames[0].addr;
+
+	return (early_free_frames_size > 0 && addr >= start &&
+		addr < start + early_free_frames_size * PAGE_SIZE);
+}
+
+static inline struct page_frame* get_page_frame_at(p_addr_t addr)
+{
+	if (!is_aligned(addr, PAGE_SIZE))
+		return NULL;
+
+	if (is_early_page_frame(addr)) {
+		p_addr_t start = early_free_frames[0].addr;
+		return &early_free_frames[(addr - start) / PAGE_SIZE];
+	}
+
+	if (!page_frame_descriptors || addr < memory_base || addr >= memory_top)
+		return NULL;
+
+	return &page_frame_descriptors[addr / PAGE_SIZE];
+}
+
+static inline pf_list_t* free_list(unsigned int order, p_addr_t addr)
+{
+#ifdef MEMORY_PAGE_COLORS
+	if (order == 0)
+		return &free_frames_by_color[page_color(addr)];
+#endif
+
+	return &free_areas[order];
+}
+
+static inline p_addr_t buddy_addr(p_addr_t addr, unsigned int order)
+{
+	return (addr ^ (PAGE_SIZE << order));
+}
+
+/**
+ * Returns the free block of 2^order frames starting at addr to the free areas,
+ * merging it with its buddy as long as the buddy is free too.
+ */
+static void free_block(p_addr_t addr, unsigned int order)
+{
+	while (order < MEMORY_PAGE_FRAMES_MAX_ORDER) {
+		struct page_frame* buddy = get_page_frame_at(buddy_addr(addr, order));
+
+		if (!buddy || !list_node_chained(&buddy->pf_list) ||
+		    buddy->order != order)
+			break;
+
+		memory_pf_list_erase(free_list(order, buddy->addr), buddy);
+
+		addr &= ~(PAGE_SIZE << order);
+		++order;
+	}
+
+	struct page_frame* pf = get_page_frame_at(addr);
+	pf->order = order;
+	memory_pf_list_insert(free_list(order, addr), pf);
+}
+
+/**
+ * Frees the [start, end[ frame range in blocks as large as alignment permits.
+ */
+static void free_range(p_addr_t start, p_addr_t end)
+{
+	while (start < end) {
+		unsigned int order = 0;
+
+		while (order < MEMORY_PAGE_FRAMES_MAX_ORDER &&
+		       is_aligned(start, PAGE_SIZE << (order + 1)) &&
+		       end - start >= (PAGE_SIZE << (order + 1)))
+			++order;
+
+		free_block(start, order);
+		nr_free_page_frames += (1 << order);
+
+		start += (PAGE_SIZE << order);
+	}
+}
+
 void __memory_early_init(void)
 {
 	p_addr_t paddr = kernel_image_get_top_page_frame();
 	size_t i;
 
-	memory_pf_list_init(&free_page_frames);
-	memory_pf_list_init(&used_page_frames);
+	for (i = 0; i < ARRAY_SIZE(free_areas); ++i)
+		memory_pf_list_init(&free_areas[i]);
+	memory_pf_list_init(&zeroed_frames);
+#ifdef MEMORY_PAGE_COLORS
+	for (i = 0; i < ARRAY_SIZE(free_frames_by_color); ++i)
+		memory_pf_list_init(&free_frames_by_color[i]);
+#endif
 
 	for (i = 0; i < ARRAY_SIZE(early_free_frames); ++i, paddr += PAGE_SIZE) {
 		early_free_frames[i].addr = paddr;
-		memory_pf_list_insert(&free_page_frames, &early_free_frames[i]);
+		list_node_init(&early_free_frames[i].pf_list);
 	}
 
 	early_free_frames_size = i;
+
+	free_range(early_free_frames[0].addr, paddr);
 }
 
 p_addr_t memory_get_memory_base(void)
@@ -105,124 +250,579 @@ p_addr_t memory_get_memory_top(void)
 	return memory_top;
 }
 
-static size_t init_frames(p_addr_t base, p_addr_t top,
-			  struct page_frame* descriptors,
-			  const mem_area_t* mem_layout,
-			  size_t layout_len,
-			  const mem_area_t* kernel_area)
+/*
+ * layout saved by memory_init() for the deferred initialization
+ */
+static const mem_area_t* layout;
+static size_t layout_len;
+static mem_area_t kernel_area;
+
+/*
+ * frames in [deferred_start, memory_top[ are not initialized yet, see
+ * memory_deferred_init()
+ */
+static p_addr_t deferred_start;
+
+static const mem_area_t* find_area(p_addr_t addr)
+{
+	return memory_layout_find_area(addr, layout, layout_len, &kernel_area);
+}
+
+/**
+ * Returns the start of the first area above addr, or top if there is none.
+ */
+static p_addr_t next_area_start(p_addr_t addr, p_addr_t top)
+{
+	p_addr_t next = top;
+
+	for (size_t i = 0; i < layout_len; ++i) {
+		if (layout[i].start > addr && layout[i].start < next)
+			next = layout[i].start;
+	}
+	if (kernel_area.start > addr && kernel_area.start < next)
+		next = kernel_area.start;
+
+	return next;
+}
+
+/**
+ * Initializes the descriptors of the [base, top[ frame range, handing the
+ * free parts to the buddy allocator as whole ranges.
+ */
+static void init_frames(p_addr_t base, p_addr_t top)
 {
 	p_addr_t paddr = base;
-	size_t i = 0;
 
 	while (paddr < top) {
-		const mem_area_t* m = memory_layout_find_area(paddr,
-							      mem_layout,
-							      layout_len,
-							      kernel_area);
+		const mem_area_t* m = find_area(paddr);
+		p_addr_t end;
+
 		if (m) {
-			while (paddr < m->start + m->size && paddr < top) {
-				descriptors[i].addr = paddr;
-				memory_pf_list_insert(&used_page_frames,
-						      &descriptors[i++]);
-				paddr += PAGE_SIZE;
-			}
+			end = m->start + m->size;
+			if (end > top)
+				end = top;
 		}
 		else {
-			descriptors[i].addr = paddr;
-			memory_pf_list_insert(&free_page_frames, &descriptors[i++]);
-			paddr += PAGE_SIZE;
+			end = next_area_start(paddr, top);
 		}
 
-	}
+		for (p_addr_t p = paddr; p < end; p += PAGE_SIZE)
+			page_frame_descriptors[p / PAGE_SIZE].addr = p;
 
-	return i;
+		if (m)
+			nr_used_page_frames += (end - paddr) / PAGE_SIZE;
+		else
+			free_range(paddr, end);
+
+		paddr = end;
+	}
 }
 
-static struct page_frame* page_frame_descriptors = NULL;
+/**
+ * Initializes the next MEMORY_DEFERRED_INIT_CHUNK frames, if any are left.
+ * Must be called with interrupts disabled.
+ *
+ * @return the number of frames initialized
+ */
+static size_t deferred_init_chunk(void)
+{
+	const p_addr_t start = deferred_start;
+	p_addr_t end;
+
+	if (start >= memory_top)
+		return 0;
+
+	end = (memory_top - start > MEMORY_DEFERRED_INIT_CHUNK * PAGE_SIZE) ?
+		start + MEMORY_DEFERRED_INIT_CHUNK * PAGE_SIZE : memory_top;
+
+	init_frames(start, end);
+	deferred_start = end;
+
+	return (end - start) / PAGE_SIZE;
+}
 
 void memory_init(size_t ram_size_bytes, const mem_area_t* mem_layout,
-		 size_t layout_len)
+		 size_t layout_len_)
 {
 	kassert(MEMORY_EARLY_FRAMES_MB * 1024 * 1024 <= ram_size_bytes);
-	const mem_area_t kernel_area = MEMORY_AREA(kernel_image_get_base_page_frame(),
-						   kernel_image_get_size(),
-						   0,
-						   "kernel");
+	p_addr_t early_top;
+	p_addr_t sync_top;
 
 	memory_base = PAGE_SIZE;
 	memory_top = page_align_down(ram_size_bytes);
 
+	layout = mem_layout;
+	layout_len = layout_len_;
+	mem_area_init(&kernel_area, kernel_image_get_base_page_frame(),
+		      kernel_image_get_size(), "kernel");
+
 	page_frame_descriptors = kcalloc(ram_size_bytes / PAGE_SIZE,
 					 sizeof(struct page_frame));
 	kassert(page_frame_descriptors != NULL);
 
-	struct page_frame* descriptor = page_frame_descriptors;
+	irq_disable();
+
+	init_frames(0, kernel_image_get_top_page_frame());
 
-	descriptor += init_frames(0, kernel_image_get_top_page_frame(),
-				  descriptor,
-				  mem_layout, layout_len, &kernel_area);
+	// early frames are described by early_free_frames
+	early_top = early_free_frames[early_free_frames_size - 1].addr + PAGE_SIZE;
+	for (p_addr_t p = early_free_frames[0].addr; p < early_top; p += PAGE_SIZE)
+		page_frame_descriptors[p / PAGE_SIZE].addr = -1;
 
-	for (size_t i = 0; i < early_free_frames_size; ++i)
-		descriptor[i].addr = -1;
-	descriptor += early_free_frames_size;
+	/*
+	 * only what is needed to boot is initialized now, the rest is done
+	 * by the [meminit] kthread, or on demand by the allocator
+	 */
+	sync_top = align_up(early_top + MEMORY_INIT_SYNC_MB * 1024 * 1024,
+			    MEMORY_DEFERRED_INIT_CHUNK * PAGE_SIZE);
+	if (sync_top > memory_top || sync_top < early_top)
+		sync_top = memory_top;
 
-	init_frames(early_free_frames[early_free_frames_size - 1].addr + PAGE_SIZE,
-		    memory_top,
-		    descriptor,
-		    mem_layout, layout_len, &kernel_area);
+	init_frames(early_top, sync_top);
+	deferred_start = sync_top;
+
+	irq_enable();
 }
 
-static inline struct page_frame* get_page_frame_at(p_addr_t addr)
+size_t memory_deferred_init(void)
+{
+	size_t nr_frames;
+
+	irq_disable();
+	nr_frames = deferred_init_chunk();
+	irq_enable();
+
+	return nr_frames;
+}
+
+static void meminit_kthread_do(void* data)
 {
-	if (!is_aligned(addr, PAGE_SIZE) || addr < memory_base || addr >= memory_top)
+	while (memory_deferred_init() > 0)
+		sched_yield();
+
+	log_printf("meminit: %u free page frames\n",
+		   (unsigned int)nr_free_page_frames);
+
+	sched_exit();
+}
+
+int memory_deferred_init_start(void)
+{
+	struct thread* meminit;
+	int err;
+
+	err = kthread_create("[meminit]", meminit_kthread_do, NULL, &meminit);
+	if (!err)
+		err = sched_add_thread(meminit);
+
+	return err;
+}
+
+static struct page_frame* pop_free_block(unsigned int order)
+{
+	struct page_frame* pf;
+	pf_list_t* list = &free_areas[order];
+
+#ifdef MEMORY_PAGE_COLORS
+	for (size_t i = 0; order == 0 && i < MEMORY_PAGE_COLORS; ++i) {
+		list = &free_frames_by_color[i];
+		if (list->n > 0)
+			break;
+	}
+#endif
+
+	if (list->n == 0)
 		return NULL;
 
-	struct page_frame* pf = &page_frame_descriptors[addr / PAGE_SIZE];
+	pf = list_entry(list_front(&list->list), struct page_frame, pf_list);
+	memory_pf_list_erase(list, pf);
 
-	if (pf->addr == -1) {
-		p_addr_t start = early_free_frames[0].addr;
-		return &early_free_frames[(addr - start) / PAGE_SIZE];
+	return pf;
+}
+
+/**
+ * Takes a block of 2^order frames from the free areas.
+ * Must be called with interrupts disabled.
+ */
+static struct page_frame* alloc_block(unsigned int order)
+{
+	struct page_frame* pf = NULL;
+	unsigned int o;
+
+	// smallest free block that is large enough
+	for (o = order; o <= MEMORY_PAGE_FRAMES_MAX_ORDER && !pf; ++o)
+		pf = pop_free_block(o);
+
+	if (pf) {
+		--o;
+
+		// split it, giving back the upper halves
+		while (o > order) {
+			--o;
+			struct page_frame* buddy =
+				get_page_frame_at(pf->addr + (PAGE_SIZE << o));
+			buddy->order = o;
+			memory_pf_list_insert(free_list(o, buddy->addr), buddy);
+		}
+
+		nr_free_page_frames -= (1 << order);
+		nr_used_page_frames += (1 << order);
 	}
 
 	return pf;
 }
 
-p_addr_t memory_page_frame_alloc()
+#ifdef MEMORY_PAGE_COLORS
+void memory_set_color_cursor(unsigned int* cursor)
+{
+	irq_disable();
+	color_cursor = cursor;
+	irq_enable();
+}
+
+/*
+ * Must be called with interrupts disabled.
+ */
+static int next_color(void)
+{
+	int color = -1;
+
+	if (color_cursor) {
+		color = *color_cursor;
+		*color_cursor = (color + 1) % MEMORY_PAGE_COLORS;
+	}
+
+	return color;
+}
+
+/**
+ * Takes a single frame of the given color, splitting a block holding every
+ * color if there is no free frame of that color.
+ * Must be called with interrupts disabled.
+ */
+static struct page_frame* alloc_colored_frame(unsigned int color)
 {
-	// no free pages left
-	if (list_empty(&free_page_frames.list))
+	pf_list_t* list = &free_frames_by_color[color];
+	struct page_frame* pf = NULL;
+	unsigned int o;
+
+	if (list->n > 0) {
+		pf = list_entry(list_front(&list->list), struct page_frame,
+				pf_list);
+		memory_pf_list_erase(list, pf);
+	}
+	else {
+		// blocks of 2^o >= MEMORY_PAGE_COLORS frames start with color 0
+		for (o = ilog2(MEMORY_PAGE_COLORS);
+		     o <= MEMORY_PAGE_FRAMES_MAX_ORDER && !pf; ++o)
+			pf = pop_free_block(o);
+		if (!pf)
+			return NULL;
+		--o;
+
+		p_addr_t addr = pf->addr;
+		const p_addr_t target = addr + color * PAGE_SIZE;
+
+		// split it, giving back the halves not holding target
+		while (o > 0) {
+			--o;
+			const size_t half = PAGE_SIZE << o;
+			struct page_frame* buddy;
+
+			if (target >= addr + half) {
+				buddy = get_page_frame_at(addr);
+				addr += half;
+			}
+			else {
+				buddy = get_page_frame_at(addr + half);
+			}
+
+			buddy->order = o;
+			memory_pf_list_insert(free_list(o, buddy->addr), buddy);
+		}
+
+		pf = get_page_frame_at(target);
+	}
+
+	--nr_free_page_frames;
+	++nr_used_page_frames;
+
+	return pf;
+}
+#endif
+
+/**
+ * @param colored if set, a single frame takes the color of the cursor
+ */
+static p_addr_t alloc_frames(unsigned int order, bool colored)
+{
+	struct page_frame* pf = NULL;
+
+	if (order > MEMORY_PAGE_FRAMES_MAX_ORDER)
 		return (p_addr_t)NULL;
 
-	struct page_frame* new_page_frame =
-		list_entry(list_front(&free_page_frames.list), struct page_frame, pf_list);
-	list_pop_front(&free_page_frames.list);
-	--free_page_frames.n;
+	irq_disable();
+
+#ifdef MEMORY_PAGE_COLORS
+	if (colored && order == 0) {
+		const int color = next_color();
+		if (color >= 0)
+			pf = alloc_colored_frame(color);
+	}
+#endif
+
+	if (!pf)
+		pf = alloc_block(order);
+
+	// the free areas ran dry before [meminit] was done: help it
+	while (!pf && deferred_init_chunk() > 0)
+		pf = alloc_block(order);
 
-	list_push_back(&used_page_frames.list, &new_page_frame->pf_list);
-	++used_page_frames.n;
+	if (!pf && order == 0 && zeroed_frames.n > 0) {
+		// last resort: the zeroed pool
+		pf = list_entry(list_front(&zeroed_frames.list),
+				struct page_frame, pf_list);
+		memory_pf_list_erase(&zeroed_frames, pf);
+
+		--nr_free_page_frames;
+		++nr_used_page_frames;
+	}
 
-	return new_page_frame->addr;
+	irq_enable();
+
+	return (pf) ? pf->addr : (p_addr_t)NULL;
 }
 
-int memory_page_frame_free(p_addr_t addr)
+p_addr_t memory_page_frames_alloc(unsigned int order)
+{
+	return alloc_frames(order, true);
+}
+
+p_addr_t memory_page_frames_alloc_max(size_t nr_frames, unsigned int* order)
+{
+	unsigned int o;
+	p_addr_t addr;
+
+	if (nr_frames == 0)
+		return (p_addr_t)NULL;
+
+	o = ilog2(nr_frames);
+	if (o > MEMORY_PAGE_FRAMES_MAX_ORDER)
+		o = MEMORY_PAGE_FRAMES_MAX_ORDER;
+
+	while (!(addr = memory_page_frames_alloc(o)) && o > 0)
+		--o;
+
+	if (addr)
+		*order = o;
+
+	return addr;
+}
+
+int memory_page_frames_free(p_addr_t addr, unsigned int order)
 {
 	struct page_frame* pf = get_page_frame_at(addr);
-	if (!pf)
+	int err = 0;
+
+	if (!pf || order > MEMORY_PAGE_FRAMES_MAX_ORDER ||
+	    !is_aligned(addr, PAGE_SIZE << order))
 		return -EINVAL;
 
 	kassert(pf->addr == addr);
+	kassert(pf->refcnt == 0);
 
-	list_erase(&pf->pf_list);
-	--used_page_frames.n;
-	list_push_front(&free_page_frames.list, &pf->pf_list);
-	++free_page_frames.n;
+	irq_disable();
+
+	// double free
+	if (list_node_chained(&pf->pf_list)) {
+		err = -EINVAL;
+	}
+	else {
+		free_block(addr, order);
+
+		nr_used_page_frames -= (1 << order);
+		nr_free_page_frames += (1 << order);
+	}
+
+	irq_enable();
+
+	return err;
+}
+
+p_addr_t memory_page_frame_alloc(void)
+{
+	return memory_page_frames_alloc(0);
+}
+
+int memory_page_frame_free(p_addr_t addr)
+{
+	return memory_page_frames_free(addr, 0);
+}
+
+int memory_page_frame_ref(p_addr_t addr)
+{
+	struct page_frame* pf = get_page_frame_at(addr);
+
+	// not RAM managed by the allocator (device memory): nothing to count
+	if (!pf)
+		return -EINVAL;
+
+	irq_disable();
+	++pf->refcnt;
+	irq_enable();
 
 	return 0;
 }
 
+int memory_page_frame_unref(p_addr_t addr)
+{
+	struct page_frame* pf = get_page_frame_at(addr);
+	bool last = true;
+
+	if (pf) {
+		irq_disable();
+
+		if (pf->refcnt > 0) {
+			--pf->refcnt;
+			last = false;
+		}
+
+		irq_enable();
+	}
+
+	return (last) ? memory_page_frame_free(addr) : 0;
+}
+
+unsigned int memory_page_frame_get_ref(p_addr_t addr)
+{
+	const struct page_frame* pf = get_page_frame_at(addr);
+
+	return (pf) ? pf->refcnt + 1 : 1;
+}
+
+void memory_page_table_set_entries(p_addr_t addr, unsigned int n)
+{
+	struct page_frame* pf = get_page_frame_at(addr);
+
+	if (pf)
+		pf->nr_entries = n;
+}
+
+unsigned int memory_page_table_get_entries(p_addr_t addr)
+{
+	const struct page_frame* pf = get_page_frame_at(addr);
+
+	return (pf) ? pf->nr_entries : 0;
+}
+
+int memory_page_table_add_entries(p_addr_t addr, int n)
+{
+	struct page_frame* pf = get_page_frame_at(addr);
+
+	// without a count, the table is never seen empty
+	if (!pf)
+		return -EINVAL;
+
+	pf->nr_entries += n;
+
+	return pf->nr_entries;
+}
+
+/*
+ * Must be called with interrupts disabled.
+ */
+static struct page_frame* find_zeroed_frame(void)
+{
+#ifdef MEMORY_PAGE_COLORS
+	if (color_cursor) {
+		list_node_t* it;
+
+		list_foreach(&zeroed_frames.list, it) {
+			struct page_frame* pf =
+				list_entry(it, struct page_frame, pf_list);
+
+			if (page_color(pf->addr) == *color_cursor) {
+				next_color();
+				return pf;
+			}
+		}
+
+		// none of this color: a colored frame is cleared inline
+		return NULL;
+	}
+#endif
+
+	if (zeroed_frames.n == 0)
+		return NULL;
+
+	return list_entry(list_front(&zeroed_frames.list), struct page_frame,
+			  pf_list);
+}
+
+p_addr_t memory_page_frame_alloc_zeroed(void)
+{
+	struct page_frame* pf;
+	p_addr_t addr;
+
+	irq_disable();
+
+	pf = find_zeroed_frame();
+	if (pf) {
+		memory_pf_list_erase(&zeroed_frames, pf);
+
+		--nr_free_page_frames;
+		++nr_used_page_frames;
+	}
+
+	irq_enable();
+
+	if (pf)
+		return pf->addr;
+
+	// pool empty: clear a frame inline
+	addr = memory_page_frame_alloc();
+	if (addr && vmm_zero_page(addr) != 0) {
+		memory_page_frame_free(addr);
+		addr = (p_addr_t)NULL;
+	}
+
+	return addr;
+}
+
+size_t memory_zeroed_pool_refill(size_t max)
+{
+	size_t i;
+
+	for (i = 0; i < max && zeroed_frames.n < MEMORY_ZEROED_POOL_SIZE; ++i) {
+		// the pool is not colored, the colors are picked when taking
+		p_addr_t addr = alloc_frames(0, false);
+		if (!addr)
+			break;
+
+		if (vmm_zero_page(addr) != 0) {
+			memory_page_frame_free(addr);
+			break;
+		}
+
+		struct page_frame* pf = get_page_frame_at(addr);
+
+		irq_disable();
+
+		pf->order = PF_ORDER_ZEROED;
+		memory_pf_list_insert(&zeroed_frames, pf);
+
+		--nr_used_page_frames;
+		++nr_free_page_frames;
+
+		irq_enable();
+	}
+
+	return i;
+}
+
 void memory_statistics(unsigned int* nb_used_page_frames,
 		       unsigned int* nb_free_page_frames)
 {
-	*nb_used_page_frames = used_page_frames.n;
-	*nb_free_page_frames = free_page_frames.n;
+	*nb_used_page_frames = nr_used_page_frames;
+	*nb_free_page_frames = nr_free_page_frames;
 }
@@ -0,0 +1,138 @@
+#include <dummyos/errno.h>
+#include <dummyos/mman.h>
+#include <fs/file.h>
+#include <kernel/mm/uaccess.h>
+#include <kernel/mm/vmm.h>
+#include <kernel/process.h>
+#include <kernel/sched/sched.h>
+#include <libk/libk.h>
+
+static int prot2vmm_prot(int prot)
+{
+	int vmm_prot = 0;
+
+	// pages cannot deny reads: PROT_NONE pages are kernel pages
+	if (prot & (PROT_READ | PROT_WRITE | PROT_EXEC))
+		vmm_prot |= VMM_PROT_USER;
+	if (prot & PROT_WRITE)
+		vmm_prot |= VMM_PROT_WRITE;
+	if (prot & PROT_EXEC)
+		vmm_prot |= VMM_PROT_EXEC;
+
+	return vmm_prot;
+}
+
+/*
+ * Checks that fd can be mapped with prot and flags, and gets the data to map
+ * before anything is replaced (MAP_FIXED).
+ */
+static int get_file_data(int fd, off_t offset, int prot, int flags,
+			 const void** data, size_t* data_size)
+{
+	struct vfs_file* file;
+
+	file = process_get_file(sched_get_current_process(), fd);
+	if (!file)
+		return -EBADF;
+
+	if (!vfs_file_perm_read(file))
+		return -EACCES;
+	if (!file->op || !file->op->mmap)
+		return -ENODEV;
+
+	// no file system can be written to: shared mappings stay read-only
+	if ((flags & VMM_MAP_SHARED) && (prot & VMM_PROT_WRITE))
+		return -EACCES;
+
+	return file->op->mmap(file, offset, data, data_size);
+}
+
+void* sys_mmap(const struct mmap_args* __user uargs)
+{
+	struct mmap_args args;
+	const void* data = NULL;
+	size_t data_size = 0;
+	v_addr_t addr;
+	size_t size;
+	int prot;
+	int flags;
+	int err;
+
+	err = copy_from_user(&args, uargs, sizeof(struct mmap_args));
+	if (err)
+		return (void*)err;
+
+	if (args.length == 0 || args.offset < 0 ||
+	    !is_aligned(args.offset, PAGE_SIZE) ||
+	    !(args.flags & MAP_SHARED) == !(args.flags & MAP_PRIVATE))
+		return (void*)-EINVAL;
+
+	size = page_align_up(args.length);
+	if (size < args.length)
+		return (void*)-ENOMEM;
+
+	prot = prot2vmm_prot(args.prot);
+	flags = (args.flags & MAP_SHARED) ? VMM_MAP_SHARED : 0;
+
+	if ((args.flags & MAP_FIXED) &&
+	    (!page_is_aligned((v_addr_t)args.addr) ||
+	     (v_addr_t)args.addr < VMM_USER_MIN_ADDR))
+		return (void*)-EINVAL;
+
+	if (!(args.flags & MAP_ANONYMOUS)) {
+		err = get_file_data(args.fd, args.offset, prot, flags, &data,
+				    &data_size);
+		if (err)
+			return (void*)err;
+
+		// see get_file_data()
+		if (flags & VMM_MAP_SHARED)
+			flags |= VMM_MAP_RDONLY;
+	}
+
+	vmm_uaccess_setup();
+
+	if (args.flags & MAP_FIXED) {
+		addr = (v_addr_t)args.addr;
+
+		// replaces whatever was mapped there
+		err = vmm_unmap_user_range(addr, size);
+	}
+	else {
+		err = vmm_find_free_range(size, PAGE_SIZE,
+					  page_align_down((v_addr_t)args.addr),
+					  &addr);
+	}
+	if (err)
+		return (void*)err;
+
+	if (args.flags & MAP_ANONYMOUS)
+		err = vmm_create_user_mapping(addr, size, prot, flags);
+	else
+		err = vmm_create_user_file_mapping(addr, size, prot, flags,
+						   data, data_size);
+	if (err)
+		return (void*)err;
+
+	// the mappings are created accessible
+	if (!(prot & VMM_PROT_USER)) {
+		err = vmm_protect_user_range(addr, size, prot);
+		if (err) {
+			vmm_unmap_user_range(addr, size);
+			return (void*)err;
+		}
+	}
+
+	return (void*)addr;
+}
+
+int sys_munmap(void* __user addr, size_t length)
+{
+	return vmm_unmap_user_range((v_addr_t)addr, length);
+}
+
+int sys_mprotect(void* __user addr, size_t length, int prot)
+{
+	return vmm_protect_user_range((v_addr_t)addr, length,
+				      prot2vmm_prot(prot));
+}
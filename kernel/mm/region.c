@@ -1,17 +1,39 @@
 #include <dummyos/errno.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <kernel/mm/memory.h>
 #include <kernel/mm/region.h>
 #include <libk/libk.h>
 
+static struct kmem_cache* region_cache;
+
+int region_cache_init(void)
+{
+	return kmem_cache_create("region", sizeof(region_t), NULL,
+				 &region_cache);
+}
+
 static void region_reset(region_t* region)
 {
-	for (size_t i = 0; i < region->nr_frames; ++i) {
-		if (region->frames[i])
-			memory_page_frame_free(region->frames[i]);
+	if (region_is_extent_based(region)) {
+		for (size_t i = 0; i < region->nr_extents; ++i) {
+			const struct region_extent* e = &region->extents[i];
+
+			for (size_t j = 0; j < e->nr_frames; ++j)
+				memory_page_frame_unref(e->start + j * PAGE_SIZE);
+		}
+
+		if (region->extents != &region->extent)
+			kfree(region->extents);
 	}
+	else {
+		for (size_t i = 0; i < region->nr_frames; ++i) {
+			if (region->frames[i])
+				memory_page_frame_unref(region->frames[i]);
+		}
 
-	kfree(region->frames);
+		kvfree(region->frames);
+	}
 
 	memset(region, 0, sizeof(region_t));
 }
@@ -19,7 +41,7 @@ static void region_reset(region_t* region)
 static void region_destroy(region_t* region)
 {
 	region_reset(region);
-	kfree(region);
+	kmem_cache_free(region_cache, region);
 }
 
 void region_unref(region_t* region)
@@ -38,30 +60,96 @@ int region_get_ref(const region_t* region)
 	return refcount_get(&region->refcnt);
 }
 
+p_addr_t region_get_frame(const region_t* region, size_t index)
+{
+	if (index >= region->nr_frames)
+		return (p_addr_t)NULL;
+
+	if (!region_is_extent_based(region))
+		return region->frames[index];
+
+	for (size_t i = 0; i < region->nr_extents; ++i) {
+		const struct region_extent* e = &region->extents[i];
+
+		if (index < e->nr_frames)
+			return e->start + index * PAGE_SIZE;
+		index -= e->nr_frames;
+	}
+
+	return (p_addr_t)NULL;
+}
+
 static void region_init_from_frames(region_t* region, p_addr_t* frames,
 				    size_t nr_frames, int prot)
 {
 	region->frames = frames;
+	region->extents = NULL;
+	region->nr_extents = 0;
 	region->nr_frames = nr_frames;
 	region->prot = prot;
 	refcount_init(&region->refcnt);
 }
 
-static int region_init_from_range(region_t* region, p_addr_t start, size_t size,
-				  int prot)
+static void region_init_extents(region_t* region, int prot)
 {
-	p_addr_t* frames;
-	size_t nr_frames = page_align_up(size) / PAGE_SIZE;
+	region->frames = NULL;
+	region->extents = &region->extent;
+	region->nr_extents = 0;
+	region->nr_frames = 0;
+	region->prot = prot;
+	refcount_init(&region->refcnt);
+}
 
-	frames = kcalloc(nr_frames, sizeof(p_addr_t));
-	if (!frames)
+int region_append_frames(region_t* region, p_addr_t start, size_t nr_frames)
+{
+	struct region_extent* last;
+
+	if (!region_is_extent_based(region))
+		return -EINVAL;
+
+	last = (region->nr_extents > 0) ?
+		&region->extents[region->nr_extents - 1] : NULL;
+
+	if (last && last->start + last->nr_frames * PAGE_SIZE == start) {
+		last->nr_frames += nr_frames;
+		region->nr_frames += nr_frames;
+		return 0;
+	}
+
+	// the array grows by powers of two, starting from the inline extent
+	const size_t n = region->nr_extents;
+	if (n > 0 && (n & (n - 1)) == 0) {
+		struct region_extent* extents =
+			kmalloc(2 * n * sizeof(struct region_extent));
+		if (!extents)
+			return -ENOMEM;
+
+		memcpy(extents, region->extents,
+		       n * sizeof(struct region_extent));
+		if (region->extents != &region->extent)
+			kfree(region->extents);
+		region->extents = extents;
+	}
+
+	region->extents[n].start = start;
+	region->extents[n].nr_frames = nr_frames;
+	++region->nr_extents;
+	region->nr_frames += nr_frames;
+
+	return 0;
+}
+
+int region_create_extents(int prot, region_t** result)
+{
+	region_t* region;
+
+	region = kmem_cache_alloc(region_cache);
+	if (!region)
 		return -ENOMEM;
 
-	p_addr_t addr = start;
-	for (size_t i = 0; i < nr_frames; ++i, addr += PAGE_SIZE)
-		frames[i] = addr;
+	region_init_extents(region, prot);
 
-	region_init_from_frames(region, frames, nr_frames, prot);
+	*result = region;
 
 	return 0;
 }
@@ -72,13 +160,14 @@ int region_create_from_range(p_addr_t start, size_t size, int prot,
 	region_t* region;
 	int err;
 
-	region = kmalloc(sizeof(region_t));
-	if (!region)
-		return -ENOMEM;
+	err = region_create_extents(prot, &region);
+	if (err)
+		return err;
 
-	err = region_init_from_range(region, start, size, prot);
+	err = region_append_frames(region, start,
+				   page_align_up(size) / PAGE_SIZE);
 	if (err) {
-		kfree(region);
+		region_unref(region);
 		region = NULL;
 	}
 
@@ -88,14 +177,24 @@ int region_create_from_range(p_addr_t start, size_t size, int prot,
 }
 
 int __region_init(region_t* region, p_addr_t* frames, size_t nr_frames,
-		  int prot)
+		  int prot, bool zeroed)
 {
 	bool frames_ok = true;
+	size_t i = 0;
 
-	for (size_t i = 0; frames_ok && i < nr_frames; ++i) {
-		frames[i] = memory_page_frame_alloc();
-		if (!frames[i])
+	while (frames_ok && i < nr_frames) {
+		unsigned int order = 0;
+		p_addr_t block = (zeroed) ?
+			memory_page_frame_alloc_zeroed() :
+			memory_page_frames_alloc_max(nr_frames - i, &order);
+
+		if (!block) {
 			frames_ok = false;
+		}
+		else {
+			for (size_t j = 0; j < (1 << order); ++j, block += PAGE_SIZE)
+				frames[i++] = block;
+		}
 	}
 
 	region_init_from_frames(region, frames, nr_frames, prot);
@@ -108,29 +207,45 @@ int __region_init(region_t* region, p_addr_t* frames, size_t nr_frames,
 	return 0;
 }
 
-static int region_init(region_t* region, size_t nr_frames, int prot)
+/*
+ * how the frames of a new region are obtained
+ */
+enum region_backing
+{
+	BACKING_ZEROED, // zeroed frames, one by one from the zeroed pool
+	BACKING_NONE, // none yet, see region_populate()
+};
+
+static int region_init(region_t* region, size_t nr_frames, int prot,
+		       enum region_backing backing)
 {
 	p_addr_t* frames;
 
-	frames = kcalloc(nr_frames, sizeof(p_addr_t));
+	frames = kvcalloc(nr_frames, sizeof(p_addr_t));
 	if (!frames)
 		return -ENOMEM;
 
-	return __region_init(region, frames, nr_frames, prot);
+	if (backing == BACKING_NONE) {
+		region_init_from_frames(region, frames, nr_frames, prot);
+		return 0;
+	}
+
+	return __region_init(region, frames, nr_frames, prot, true);
 }
 
-int region_create(size_t nr_frames, int prot, region_t** result)
+static int __region_create(size_t nr_frames, int prot,
+			   enum region_backing backing, region_t** result)
 {
 	region_t* region;
 	int err;
 
-	region = kmalloc(sizeof(region_t));
+	region = kmem_cache_alloc(region_cache);
 	if (!region)
 		return -ENOMEM;
 
-	err = region_init(region, nr_frames, prot);
+	err = region_init(region, nr_frames, prot, backing);
 	if (err) {
-		kfree(region);
+		kmem_cache_free(region_cache, region);
 		region = NULL;
 	}
 
@@ -138,3 +253,267 @@ int region_create(size_t nr_frames, int prot, region_t** result)
 
 	return err;
 }
+
+int region_create_zeroed(size_t nr_frames, int prot, region_t** result)
+{
+	return __region_create(nr_frames, prot, BACKING_ZEROED, result);
+}
+
+int region_create_unpopulated(size_t nr_frames, int prot, region_t** result)
+{
+	return __region_create(nr_frames, prot, BACKING_NONE, result);
+}
+
+int region_populate(region_t* region, size_t index, p_addr_t* frame)
+{
+	if (region_is_extent_based(region) || index >= region->nr_frames)
+		return -EINVAL;
+
+	if (!region->frames[index]) {
+		p_addr_t f = memory_page_frame_alloc_zeroed();
+		if (!f)
+			return -ENOMEM;
+
+		region->frames[index] = f;
+	}
+
+	*frame = region->frames[index];
+
+	return 0;
+}
+
+void region_depopulate(region_t* region, size_t index)
+{
+	if (region_is_extent_based(region) || index >= region->nr_frames ||
+	    !region->frames[index])
+		return;
+
+	memory_page_frame_unref(region->frames[index]);
+	region->frames[index] = 0;
+}
+
+/*
+ * Fills frames with the frame backing each page of region.
+ */
+static void region_get_frames(const region_t* region, p_addr_t* frames)
+{
+	size_t i = 0;
+
+	if (!region_is_extent_based(region)) {
+		memcpy(frames, region->frames, region->nr_frames * sizeof(p_addr_t));
+		return;
+	}
+
+	for (size_t e = 0; e < region->nr_extents; ++e) {
+		const struct region_extent* ext = &region->extents[e];
+
+		for (size_t j = 0; j < ext->nr_frames; ++j)
+			frames[i++] = ext->start + j * PAGE_SIZE;
+	}
+}
+
+int region_copy_create(const region_t* src, region_t** result)
+{
+	region_t* region;
+	p_addr_t* frames;
+
+	region = kmem_cache_alloc(region_cache);
+	if (!region)
+		return -ENOMEM;
+
+	frames = kvcalloc(src->nr_frames, sizeof(p_addr_t));
+	if (!frames) {
+		kmem_cache_free(region_cache, region);
+		return -ENOMEM;
+	}
+
+	region_get_frames(src, frames);
+	for (size_t i = 0; i < src->nr_frames; ++i) {
+		if (frames[i])
+			memory_page_frame_ref(frames[i]);
+	}
+
+	region_init_from_frames(region, frames, src->nr_frames, src->prot);
+
+	*result = region;
+
+	return 0;
+}
+
+/*
+ * Switches an extent based region to one entry per page, so that pages can
+ * be backed individually.
+ */
+static int region_expand_extents(region_t* region)
+{
+	p_addr_t* frames;
+
+	frames = kvcalloc(region->nr_frames, sizeof(p_addr_t));
+	if (!frames)
+		return -ENOMEM;
+
+	region_get_frames(region, frames);
+
+	if (region->extents != &region->extent)
+		kfree(region->extents);
+	region->extents = NULL;
+	region->nr_extents = 0;
+	region->frames = frames;
+
+	return 0;
+}
+
+int region_set_frame(region_t* region, size_t index, p_addr_t frame)
+{
+	int err;
+
+	if (index >= region->nr_frames)
+		return -EINVAL;
+
+	if (region_is_extent_based(region)) {
+		err = region_expand_extents(region);
+		if (err)
+			return err;
+	}
+
+	region->frames[index] = frame;
+
+	return 0;
+}
+
+int region_split(region_t* region, size_t index, region_t** result)
+{
+	const size_t nr_frames = region->nr_frames - index;
+	region_t* tail;
+	p_addr_t* frames;
+	int err;
+
+	if (index == 0 || index >= region->nr_frames)
+		return -EINVAL;
+
+	// the other holders still map it as a whole
+	if (region_get_ref(region) > 1)
+		return -ENOTSUP;
+
+	if (region_is_extent_based(region)) {
+		err = region_expand_extents(region);
+		if (err)
+			return err;
+	}
+
+	tail = kmem_cache_alloc(region_cache);
+	if (!tail)
+		return -ENOMEM;
+
+	frames = kvmalloc(nr_frames * sizeof(p_addr_t));
+	if (!frames) {
+		kmem_cache_free(region_cache, tail);
+		return -ENOMEM;
+	}
+
+	memcpy(frames, &region->frames[index], nr_frames * sizeof(p_addr_t));
+	region_init_from_frames(tail, frames, nr_frames, region->prot);
+
+	region->nr_frames = index;
+
+	*result = tail;
+
+	return 0;
+}
+
+int region_grow_down(region_t* region, size_t nr_frames)
+{
+	p_addr_t* frames;
+	int err;
+
+	if (region_get_ref(region) > 1)
+		return -ENOTSUP;
+
+	if (region_is_extent_based(region)) {
+		err = region_expand_extents(region);
+		if (err)
+			return err;
+	}
+
+	frames = kvcalloc(region->nr_frames + nr_frames, sizeof(p_addr_t));
+	if (!frames)
+		return -ENOMEM;
+
+	memcpy(&frames[nr_frames], region->frames,
+	       region->nr_frames * sizeof(p_addr_t));
+	kvfree(region->frames);
+
+	region->frames = frames;
+	region->nr_frames += nr_frames;
+
+	return 0;
+}
+
+int region_grow_up(region_t* region, size_t nr_frames)
+{
+	p_addr_t* frames;
+	int err;
+
+	if (region_get_ref(region) > 1)
+		return -ENOTSUP;
+
+	if (region_is_extent_based(region)) {
+		err = region_expand_extents(region);
+		if (err)
+			return err;
+	}
+
+	frames = kvcalloc(region->nr_frames + nr_frames, sizeof(p_addr_t));
+	if (!frames)
+		return -ENOMEM;
+
+	memcpy(frames, region->frames, region->nr_frames * sizeof(p_addr_t));
+	kvfree(region->frames);
+
+	region->frames = frames;
+	region->nr_frames += nr_frames;
+
+	return 0;
+}
+
+int region_merge(region_t* region, region_t* next)
+{
+	p_addr_t* frames;
+	int err;
+
+	if (region_get_ref(region) > 1 || region_get_ref(next) > 1)
+		return -ENOTSUP;
+
+	if (region_is_extent_based(region)) {
+		err = region_expand_extents(region);
+		if (err)
+			return err;
+	}
+
+	frames = kvmalloc((region->nr_frames + next->nr_frames) *
+			  sizeof(p_addr_t));
+	if (!frames)
+		return -ENOMEM;
+
+	memcpy(frames, region->frames, region->nr_frames * sizeof(p_addr_t));
+	region_get_frames(next, &frames[region->nr_frames]);
+	kvfree(region->frames);
+
+	region->frames = frames;
+	region->nr_frames += next->nr_frames;
+
+	// the frames now belong to region
+	if (region_is_extent_based(next)) {
+		if (next->extents != &next->extent)
+			kfree(next->extents);
+		next->extents = NULL;
+		next->nr_extents = 0;
+	}
+	else {
+		kvfree(next->frames);
+	}
+	next->frames = NULL;
+	next->nr_frames = 0;
+
+	return 0;
+}
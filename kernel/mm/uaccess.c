@@ -1,116 +1,88 @@
 #include <dummyos/errno.h>
 #include <kernel/kmalloc.h>
 #include <kernel/mm/uaccess.h>
-#include <kernel/sched/sched.h>
+#include <kernel/mm/vmm.h>
+#include <libk/libk.h>
 
-/** @see kernel/mm/vmm.c */
-extern v_addr_t __fixup_addr;
-
-// this is used to avoid the compiler optimizing away the fixup label
-int __false = 0;
-
-#define uaccess_setup(fixup_label)			\
-	do {						\
-		__fixup_addr = (v_addr_t)&&fixup_label; \
-		vmm_uaccess_setup();			\
-		if (__false)				\
-		goto fixup;				\
-	} while (0)
-
-#define uaccess_reset() \
-	__fixup_addr = 0
-
-
-static int uaccess_memcpy(void* to, const void* from, size_t n)
-{
-	char* dst = to;
-	const char* s = from;
-
-	uaccess_setup(fixup);
-
-	for ( ; n > 0; ++dst, ++s, --n)
-		*dst = *s;
-
-	uaccess_reset();
-
-	return 0;
-
-fixup:
-	uaccess_reset();
-	return -EFAULT;
-}
+/*
+ * primitives implemented by the arch (uaccess.S): each instruction touching
+ * user memory is in the exception table, a fault makes them return -EFAULT
+ */
+int __uaccess_copy(void* to, const void* from, size_t n);
+int __uaccess_memset(void* s, int c, size_t n);
+ssize_t __uaccess_strnlen(const char* s, size_t n);
 
 int copy_to_user(void* __user to, const void* from, size_t n)
 {
-	return uaccess_memcpy(to, from, n);
+	vmm_uaccess_setup();
+
+	return __uaccess_copy(to, from, n);
 }
 
 int copy_from_user(void* to, const void* __user from, size_t n)
 {
-	return uaccess_memcpy(to, from, n);
+	vmm_uaccess_setup();
+
+	return __uaccess_copy(to, from, n);
 }
 
 ssize_t strnlen_user(const char* __user str, ssize_t n)
 {
-	const char* s = str;
-
-	uaccess_setup(fixup);
-
-	while (n > 0 && *s) {
-		++s;
-		--n;
-	}
+	if (n <= 0)
+		return 0;
 
-	uaccess_reset();
+	vmm_uaccess_setup();
 
-	return (s - str);
-
-fixup:
-	uaccess_reset();
-	return -EFAULT;
+	return __uaccess_strnlen(str, n);
 }
 
-ssize_t uaccess_strlcpy(char* dest, const char* src, ssize_t n)
+ssize_t strlcpy_to_user(char* __user dest, const char* src, ssize_t n)
 {
-	const char* src0 = src;
-	size_t s = n;
+	const ssize_t len = strlen(src);
+	size_t copied;
+	int err;
 
-	uaccess_setup(fixup);
+	if (n <= 0)
+		return len;
 
-	for ( ; n > 1 && *src; ++dest, ++src, --n)
-		*dest = *src;
+	vmm_uaccess_setup();
 
-	if (n == 0 || n == 1) {
-		if (s != 0)
-			*dest = '\0';
+	copied = (len < n) ? len : n - 1;
+	err = __uaccess_copy(dest, src, copied);
+	if (!err)
+		err = __uaccess_copy(dest + copied, "", 1);
 
-		while (*src)
-			++src;
-	}
+	return (err) ? err : len;
+}
 
-	uaccess_reset();
+ssize_t strlcpy_from_user(char* dest, const char* __user src, ssize_t n)
+{
+	ssize_t len;
+	size_t copied;
+	int err;
 
-	return (src - src0);
+	vmm_uaccess_setup();
 
-fixup:
-	uaccess_reset();
-	return -EFAULT;
-}
+	// the whole source is measured, as with strlcpy()
+	len = __uaccess_strnlen(src, (size_t)-1);
+	if (len < 0 || n <= 0)
+		return len;
 
-ssize_t strlcpy_to_user(char* __user dest, const char* src, ssize_t n)
-{
-	return uaccess_strlcpy(dest, src, n);
-}
+	copied = (len < n) ? len : n - 1;
+	err = __uaccess_copy(dest, src, copied);
+	if (err)
+		return err;
 
-ssize_t strlcpy_from_user(char* dest, const char* __user src, ssize_t n)
-{
-	return uaccess_strlcpy(dest, src, n);
+	dest[copied] = '\0';
+
+	return len;
 }
 
 int strndup_from_user(const char* __user str, ssize_t n, char** dup)
 {
 	char* copy;
 	ssize_t size;
+	int err;
 
 	size = strnlen_user(str, n);
 	if (size <= 0)
@@ -120,12 +92,13 @@ int strndup_from_user(const char* __user str, ssize_t n, char** dup)
 	if (!copy)
 		return -ENOMEM;
 
-	size = strlcpy_from_user(copy, str, size + 1);
-	if (size < 0) {
+	err = copy_from_user(copy, str, size);
+	if (err) {
 		kfree(copy);
-		return size;
+		return err;
 	}
 
+	copy[size] = '\0';
 	*dup = copy;
 
 	return 0;
@@ -133,16 +106,7 @@ int strndup_from_user(const char* __user str, ssize_t n, char** dup)
 
 int memset_user(void *s, int c, size_t size)
 {
-	char* s0 = s;
-
-	uaccess_setup(fixup);
-
-	for ( ; size > 0; ++s0, --size)
-		*s0 = c;
-
-	return 0;
+	vmm_uaccess_setup();
 
-fixup:
-	uaccess_reset();
-	return -EFAULT;
+	return __uaccess_memset(s, c, size);
 }
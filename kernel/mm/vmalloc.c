@@ -0,0 +1,172 @@
+#include <dummyos/errno.h>
+#include <kernel/interrupt.h>
+#include <kernel/kmalloc.h>
+#include <kernel/log.h>
+#include <kernel/mm/memory.h>
+#include <kernel/mm/vmalloc.h>
+#include <kernel/mm/vmm.h>
+#include <libk/list.h>
+
+// unmapped page following each area, catches overflows
+#define GUARD_SIZE PAGE_SIZE
+
+struct vmalloc_area
+{
+	v_addr_t start;
+	size_t size;
+	uint8_t site; // in the kmalloc profiler
+
+	list_node_t va_list;
+};
+
+static LIST_DEFINE(areas); // sorted by address
+
+/**
+ * @brief Finds a hole large enough for area in the vmalloc window (first-fit)
+ */
+static int reserve(struct vmalloc_area* area)
+{
+	const size_t size = area->size + GUARD_SIZE;
+	v_addr_t start = VMALLOC_START;
+	list_node_t* it;
+	int err = 0;
+
+	irq_disable();
+
+	list_foreach(&areas, it) {
+		const struct vmalloc_area* cur =
+			list_entry(it, struct vmalloc_area, va_list);
+
+		if (cur->start - start >= size)
+			break;
+
+		start = cur->start + cur->size + GUARD_SIZE;
+	}
+
+	if (VMALLOC_END - start >= size) {
+		area->start = start;
+		list_insert_before(it, &area->va_list);
+	}
+	else {
+		err = -ENOMEM;
+	}
+
+	irq_enable();
+
+	return err;
+}
+
+static struct vmalloc_area* release(v_addr_t start)
+{
+	struct vmalloc_area* area = NULL;
+	list_node_t* it;
+
+	irq_disable();
+
+	list_foreach(&areas, it) {
+		struct vmalloc_area* cur =
+			list_entry(it, struct vmalloc_area, va_list);
+
+		if (cur->start == start) {
+			list_erase(&cur->va_list);
+			area = cur;
+			break;
+		}
+	}
+
+	irq_enable();
+
+	return area;
+}
+
+static void unmap_pages(v_addr_t start, size_t size)
+{
+	for (v_addr_t page = start; page < start + size; page += PAGE_SIZE) {
+		p_addr_t frame;
+
+		if (vmm_virt_to_phys(page, &frame) == 0 &&
+		    vmm_unmap_kernel_page(page) == 0)
+			memory_page_frame_free(frame);
+	}
+}
+
+static int map_pages(v_addr_t start, size_t size)
+{
+	size_t mapped = 0;
+	int err = 0;
+
+	while (mapped < size && !err) {
+		p_addr_t frame = memory_page_frame_alloc();
+		if (!frame) {
+			err = -ENOMEM;
+		}
+		else {
+			err = vmm_map_kernel_page(frame, start + mapped,
+						  VMM_PROT_WRITE);
+			if (!err)
+				mapped += PAGE_SIZE;
+			else
+				memory_page_frame_free(frame);
+		}
+	}
+
+	if (err)
+		unmap_pages(start, mapped);
+
+	return err;
+}
+
+void* __vmalloc(size_t size, const void* key, bool tagged)
+{
+	struct vmalloc_area* area;
+
+	if (size == 0 || size > VMALLOC_END - VMALLOC_START - GUARD_SIZE)
+		return NULL;
+
+	area = kmalloc(sizeof(struct vmalloc_area));
+	if (!area)
+		return NULL;
+
+	area->size = page_align_up(size);
+
+	if (reserve(area) != 0)
+		goto fail_reserve;
+
+	if (map_pages(area->start, area->size) != 0)
+		goto fail_map;
+
+	area->site = kmalloc_profile_alloc(key, tagged, size, area->size);
+
+	return (void*)area->start;
+
+fail_map:
+	release(area->start);
+fail_reserve:
+	kfree(area);
+
+	return NULL;
+}
+
+void* vmalloc(size_t size)
+{
+	return __vmalloc(size, __builtin_return_address(0), false);
+}
+
+void vfree(void* addr)
+{
+	struct vmalloc_area* area;
+
+	if (!addr)
+		return;
+
+	area = release((v_addr_t)addr);
+	if (!area) {
+		log_i_printf("Trying to vfree an invalid address! (%p)\n", addr);
+		return;
+	}
+
+	kmalloc_profile_free(area->site, area->size);
+
+	unmap_pages(area->start, area->size);
+	kfree(area);
+}
@@ -2,7 +2,9 @@
 #include <kernel/kassert.h>
 #include <kernel/kmalloc.h>
 #include <kernel/log.h>
+#include <kernel/mm/extable.h>
 #include <kernel/mm/memory.h>
+#include <kernel/mm/uaccess.h>
 #include <kernel/mm/vmm.h>
 #include <kernel/sched/sched.h>
 #include <kernel/sched/sched.h>
@@ -12,13 +14,22 @@
 /** arch specific implementation of the vmm interface */
 static const struct vmm_interface* vmm_impl = NULL;
 
-/** created vmm list */
-static LIST_DEFINE(vmm_list);
-
 /** the vmm context we are currently running on */
 static struct vmm* current_vmm = NULL;
-
-v_addr_t __fixup_addr = 0;
+#ifdef MEMORY_PAGE_COLORS
+static unsigned int next_vmm_color = 0;
+#endif
+
+/*
+ * The kernel is not preemptible and interrupt handlers do not unmap user
+ * pages: a single batch is enough.
+ */
+static struct
+{
+	unsigned int depth;
+	size_t nr_pages; // above VMM_TLB_BATCH_PAGES: flush all
+	v_addr_t pages[VMM_TLB_BATCH_PAGES];
+} tlb_batch;
 
 int vmm_interface_register(const struct vmm_interface* impl)
 {
@@ -30,6 +41,42 @@ int vmm_interface_register(const struct vmm_interface* impl)
 	return 0;
 }
 
+void vmm_tlb_batch_begin(void)
+{
+	++tlb_batch.depth;
+}
+
+void vmm_tlb_batch_end(void)
+{
+	kassert(tlb_batch.depth > 0);
+
+	if (--tlb_batch.depth > 0)
+		return;
+
+	if (tlb_batch.nr_pages > VMM_TLB_BATCH_PAGES) {
+		vmm_impl->flush_user_tlb();
+	}
+	else {
+		for (size_t i = 0; i < tlb_batch.nr_pages; ++i)
+			vmm_impl->invalidate_tlb_page(tlb_batch.pages[i]);
+	}
+
+	tlb_batch.nr_pages = 0;
+}
+
+bool vmm_tlb_batch_defer(v_addr_t virt)
+{
+	if (tlb_batch.depth == 0)
+		return false;
+
+	if (tlb_batch.nr_pages < VMM_TLB_BATCH_PAGES)
+		tlb_batch.pages[tlb_batch.nr_pages] = virt;
+	if (tlb_batch.nr_pages <= VMM_TLB_BATCH_PAGES)
+		++tlb_batch.nr_pages;
+
+	return true;
+}
+
 struct vmm* vmm_get_current_vmm(void)
 {
 	return current_vmm;
@@ -47,39 +94,191 @@ void vmm_switch_to(struct vmm* vmm)
 		current_vmm = vmm;
 		vmm_ref(vmm);
 
+#ifdef MEMORY_PAGE_COLORS
+		memory_set_color_cursor(&vmm->color);
+#endif
+
 		vmm_impl->switch_to(vmm);
 	}
 }
 
 
-static mapping_t* find_mapping(const list_t* mappings, v_addr_t addr)
+/*
+ * Returns the mapping with the highest start address not above addr.
+ */
+static mapping_t* find_prev_mapping(const struct vmm* vmm, v_addr_t addr)
 {
-	list_node_t* it;
+	const rb_node_t* node = vmm->mapping_tree.node;
+	mapping_t* prev = NULL;
 
-	list_foreach(mappings, it) {
-		mapping_t* m = list_entry(it, mapping_t, m_list);
+	while (node) {
+		mapping_t* m = rb_entry(node, mapping_t, m_rb);
 
-		if (mapping_contains_addr(m, addr))
-			return m;
+		if (addr < m->start) {
+			node = node->left;
+		}
+		else {
+			prev = m;
+			node = node->right;
+		}
 	}
 
-	return NULL;
+	return prev;
 }
 
-static void add_mapping(list_t* mappings, mapping_t* mapping)
+static mapping_t* find_mapping(struct vmm* vmm, v_addr_t addr)
 {
-	list_node_t* it;
+	mapping_t* m = vmm->mapping_cache;
+
+	if (m && mapping_contains_addr(m, addr))
+		return m;
+
+	// mappings do not overlap: only the previous one can hold addr
+	m = find_prev_mapping(vmm, addr);
+	if (!m || !mapping_contains_addr(m, addr))
+		return NULL;
+
+	vmm->mapping_cache = m;
+
+	return m;
+}
+
+static inline mapping_t* next_mapping(struct vmm* vmm, const mapping_t* m)
+{
+	return (m->m_list.next != &vmm->mappings) ?
+		list_entry(m->m_list.next, mapping_t, m_list) : NULL;
+}
+
+static inline v_addr_t prev_mapping_end(struct vmm* vmm, const mapping_t* m)
+{
+	const mapping_t* prev;
+
+	if (m->m_list.prev == &vmm->mappings)
+		return USER_SPACE_START;
+
+	prev = list_entry(m->m_list.prev, mapping_t, m_list);
+
+	return prev->start + prev->size;
+}
+
+static void mapping_gap_update(rb_node_t* node)
+{
+	mapping_t* m = rb_entry(node, mapping_t, m_rb);
+	size_t max_gap = m->gap;
 
-	list_foreach(mappings, it) {
-		mapping_t* m = list_entry(it, mapping_t, m_list);
+	if (node->left) {
+		const mapping_t* l = rb_entry(node->left, mapping_t, m_rb);
+		if (l->max_gap > max_gap)
+			max_gap = l->max_gap;
+	}
+	if (node->right) {
+		const mapping_t* r = rb_entry(node->right, mapping_t, m_rb);
+		if (r->max_gap > max_gap)
+			max_gap = r->max_gap;
+	}
+
+	m->max_gap = max_gap;
+}
 
-		if (m->start > mapping->start) {
-			list_insert_after(it, &mapping->m_list);
-			return;
+/*
+ * Recomputes the gap below m, after the mapping preceding it changed.
+ */
+static void update_gap(struct vmm* vmm, mapping_t* m)
+{
+	m->gap = m->start - prev_mapping_end(vmm, m);
+	rb_propagate(&m->m_rb, mapping_gap_update);
+}
+
+static void add_mapping(struct vmm* vmm, mapping_t* mapping)
+{
+	rb_node_t** link = &vmm->mapping_tree.node;
+	rb_node_t* parent = NULL;
+	mapping_t* prev = NULL;
+	mapping_t* next;
+
+	while (*link) {
+		mapping_t* m = rb_entry(*link, mapping_t, m_rb);
+
+		parent = *link;
+		if (mapping->start < m->start) {
+			link = &parent->left;
+		}
+		else {
+			prev = m;
+			link = &parent->right;
 		}
 	}
 
-	list_push_back(mappings, &mapping->m_list);
+	// keep the list sorted too, for in-order walks and neighbours
+	if (prev)
+		list_insert_after(&prev->m_list, &mapping->m_list);
+	else
+		list_push_front(&vmm->mappings, &mapping->m_list);
+
+	mapping->gap = mapping->start - prev_mapping_end(vmm, mapping);
+	mapping->max_gap = mapping->gap;
+	rb_link_node(&mapping->m_rb, parent, link);
+	rb_insert_augmented(&mapping->m_rb, &vmm->mapping_tree,
+			    mapping_gap_update);
+
+	next = next_mapping(vmm, mapping);
+	if (next)
+		update_gap(vmm, next);
+}
+
+static void remove_mapping(struct vmm* vmm, mapping_t* mapping)
+{
+	mapping_t* next = next_mapping(vmm, mapping);
+
+	rb_erase_augmented(&mapping->m_rb, &vmm->mapping_tree,
+			   mapping_gap_update);
+	list_erase(&mapping->m_list);
+
+	if (next)
+		update_gap(vmm, next);
+
+	if (vmm->mapping_cache == mapping)
+		vmm->mapping_cache = NULL;
+}
+
+static inline mapping_t* prev_mapping(struct vmm* vmm, const mapping_t* m)
+{
+	return (m->m_list.prev != &vmm->mappings) ?
+		list_entry(m->m_list.prev, mapping_t, m_list) : NULL;
+}
+
+/*
+ * Merges next into mapping, if they are compatible.
+ */
+static bool merge_mappings(struct vmm* vmm, mapping_t* mapping,
+			   mapping_t* next)
+{
+	if (!mapping_can_merge(mapping, next) || mapping_merge(mapping, next))
+		return false;
+
+	// the pages of next are already mapped where they belong
+	remove_mapping(vmm, next);
+	mapping_destroy(next);
+
+	return true;
+}
+
+/*
+ * Merges mapping with its neighbours, so that the number of mappings does
+ * not grow with every adjacent mapping created. Returns the mapping now
+ * holding mapping's pages.
+ */
+static mapping_t* merge_adjacent(struct vmm* vmm, mapping_t* mapping)
+{
+	mapping_t* prev = prev_mapping(vmm, mapping);
+	mapping_t* next = next_mapping(vmm, mapping);
+
+	if (next)
+		merge_mappings(vmm, mapping, next);
+	if (prev && merge_mappings(vmm, prev, mapping))
+		mapping = prev;
+
+	return mapping;
 }
 
 int vmm_create(struct vmm** result)
@@ -94,32 +293,39 @@ int vmm_create(struct vmm** result)
 	vmm = *result;
 
 	list_init(&vmm->mappings);
+	rb_root_init(&vmm->mapping_tree);
+	vmm->mapping_cache = NULL;
 	refcount_init(&vmm->refcnt);
 
-	list_push_back(&vmm_list, &vmm->vmm_list_node);
+#ifdef MEMORY_PAGE_COLORS
+	// spread the address spaces over the colors too
+	vmm->color = next_vmm_color;
+	next_vmm_color = (next_vmm_color + 1) % MEMORY_PAGE_COLORS;
+#endif
 
 	return 0;
 }
 
-static void vmm_destroy_mappings(list_t* mappings)
+static void vmm_destroy_mappings(struct vmm* vmm)
 {
 	list_node_t* it;
 	list_node_t* next;
 
-	list_foreach_safe(mappings, it, next) {
+	list_foreach_safe(&vmm->mappings, it, next) {
 		mapping_t* mapping = list_entry(it, mapping_t, m_list);
 		list_erase(it);
 
 		mapping_destroy(mapping);
 	}
 
+	rb_root_init(&vmm->mapping_tree);
+	vmm->mapping_cache = NULL;
 }
 
 static void vmm_destroy(struct vmm* vmm)
 {
 	log_i_printf("VMM_DESTROY: %p\n", (void*)vmm);
-	vmm_destroy_mappings(&vmm->mappings);
-	list_erase(&vmm->vmm_list_node);
+	vmm_destroy_mappings(vmm);
 	vmm_impl->destroy(vmm);
 
 	memset(vmm, 0, sizeof(struct vmm));
@@ -143,42 +349,52 @@ void vmm_uaccess_setup(void)
 		vmm_switch_to(thread->process->vmm);
 }
 
-int vmm_sync_kernel_space(void* data)
+/*
+ * Protection of a page backed by frame: frames shared copy-on-write (since fork,
+ * or with a file) are kept read-only until copied.
+ */
+static inline int page_prot(p_addr_t frame, int prot)
 {
-	list_node_t* it;
+	if (memory_page_frame_get_ref(frame) > 1)
+		prot &= ~VMM_PROT_WRITE;
 
-	list_foreach(&vmm_list, it) {
-		struct vmm* vmm = list_entry(it, struct vmm, vmm_list_node);
-		if (current_vmm != vmm) {
-			int err = vmm_impl->sync_kernel_space(vmm, data);
-			if (err) {
-				log_e_printf("%s: failed to sync kernel mapping (data=%p),"
-					     "vmm %p\n", __func__, (void*)data, (void*)vmm);
-				PANIC("sync kernel space");
-			}
-		}
-	}
+	return prot;
+}
 
-	return 0;
+static inline bool mapping_page_populated(const mapping_t* mapping,
+					  size_t index)
+{
+	return (region_get_frame(mapping->region, index) != 0);
 }
 
-static int __unmap_mapping(v_addr_t addr, size_t nr_pages)
+/*
+ * Unmaps the first nr_pages pages of mapping, skipping those not populated.
+ */
+static int __unmap_mapping(const mapping_t* mapping, size_t nr_pages)
 {
+	v_addr_t addr = mapping->start;
 	int err = 0;
 
+	vmm_tlb_batch_begin();
+
 	for (size_t i = 0; !err && i < nr_pages; ++i, addr += PAGE_SIZE) {
+		if (!mapping_page_populated(mapping, i))
+			continue;
+
 		if (vmm_is_userspace_address(addr))
 			err = vmm_impl->unmap_user_page(addr);
 		else
 			err = vmm_impl->unmap_kernel_page(addr);
 	}
 
+	vmm_tlb_batch_end();
+
 	return err;
 }
 
 static int unmap_mapping(const mapping_t* mapping)
 {
-	return __unmap_mapping(mapping->start, mapping_size_in_pages(mapping));
+	return __unmap_mapping(mapping, mapping_size_in_pages(mapping));
 }
 
 static int vmm_destroy_mapping(mapping_t* mapping)
@@ -195,33 +411,56 @@ static int vmm_destroy_mapping(mapping_t* mapping)
 static int map_mapping(const mapping_t* mapping,
 		       int (* const map_page)(p_addr_t, v_addr_t, int))
 {
+	const region_t* region = mapping->region;
 	v_addr_t addr = mapping->start;
 	size_t nr_pages = mapping_size_in_pages(mapping);
+	size_t i = 0;
+	int err = 0;
 
-	for (size_t i = 0; i < nr_pages; ++i, addr += PAGE_SIZE) {
-		int err = map_page(mapping->region->frames[i], addr,
-				   mapping->region->prot);
-		if (err) {
-			__unmap_mapping(mapping->start, i);
-			return err;
+	if (region_is_extent_based(region)) {
+		// one run of contiguous frames at a time
+		for (size_t e = 0; e < region->nr_extents && !err; ++e) {
+			p_addr_t frame = region->extents[e].start;
+			size_t n = region->extents[e].nr_frames;
+
+			for (; n > 0 && i < nr_pages && !err; --n, ++i) {
+				err = map_page(frame, addr,
+					       page_prot(frame, region->prot));
+				frame += PAGE_SIZE;
+				addr += PAGE_SIZE;
+			}
+		}
+	}
+	else {
+		// pages not populated yet are mapped on first touch
+		for (; i < nr_pages && !err; ++i, addr += PAGE_SIZE) {
+			if (region->frames[i])
+				err = map_page(region->frames[i], addr,
+					       page_prot(region->frames[i],
+							 region->prot));
 		}
 	}
 
-	return 0;
+	if (err)
+		__unmap_mapping(mapping, i - 1);
+
+	return err;
 }
 
-static int vmm_find_and_destroy_mapping(list_t* mappings, v_addr_t addr)
+static int vmm_find_and_destroy_mapping(struct vmm* vmm, v_addr_t addr)
 {
 	mapping_t* mapping;
 	int err;
 
-	mapping = find_mapping(mappings, addr);
+	mapping = find_mapping(vmm, addr);
 	if (!mapping)
 		return -EINVAL;
 
+	remove_mapping(vmm, mapping);
+
 	err = vmm_destroy_mapping(mapping);
-	if (!err)
-		list_erase(&mapping->m_list);
+	if (err)
+		add_mapping(vmm, mapping);
 
 	return err;
 }
@@ -242,6 +481,27 @@ int vmm_map_kernel_page(p_addr_t phys, v_addr_t virt, int prot)
 	return vmm_impl->map_kernel_page(phys, virt, prot);
 }
 
+int vmm_unmap_kernel_page(v_addr_t virt)
+{
+	if (!page_is_aligned(virt) || vmm_is_userspace_address(virt))
+		return -EINVAL;
+
+	return vmm_impl->unmap_kernel_page(virt);
+}
+
+int vmm_zero_page(p_addr_t frame)
+{
+	if (!page_is_aligned(frame))
+		return -EINVAL;
+
+	return vmm_impl->zero_page(frame);
+}
+
+int vmm_virt_to_phys(v_addr_t virt, p_addr_t* phys)
+{
+	return vmm_impl->virt_to_phys(virt, phys);
+}
+
 int vmm_map_kernel_range(p_addr_t phys, v_addr_t virt, size_t size, int prot)
 {
 	size_t i = 0;
@@ -286,7 +546,7 @@ int vmm_clone(struct vmm* vmm, struct vmm* clone)
 		if (err) // FIXME
 			return err;
 
-		list_push_back(&clone->mappings, &cpy->m_list);
+		add_mapping(clone, cpy);
 	}
 
 	err = vmm_impl->clone_current(clone);
@@ -304,7 +564,7 @@ bool vmm_is_userspace_address(v_addr_t addr)
 bool vmm_is_valid_userspace_address(v_addr_t addr)
 {
 	return (vmm_is_userspace_address(addr) &&
-		find_mapping(&current_vmm->mappings, addr));
+		find_mapping(current_vmm, addr));
 }
 
 static inline bool range_in_userspace(v_addr_t start, size_t size)
@@ -321,7 +581,7 @@ int vmm_create_user_mapping(v_addr_t addr, size_t size, int prot, int flags)
 	vmm_uaccess_setup();
 
 	size = page_align_up(size);
-	if (!range_in_userspace(addr, size) && !is_aligned(addr, PAGE_SIZE))
+	if (!range_in_userspace(addr, size) || !is_aligned(addr, PAGE_SIZE))
 		return -EINVAL;
 
 	err = mapping_create(addr, size, prot | VMM_PROT_USER, flags, &mapping);
@@ -332,7 +592,8 @@ int vmm_create_user_mapping(v_addr_t addr, size_t size, int prot, int flags)
 	if (err)
 		goto destroy_mapping;
 
-	add_mapping(&current_vmm->mappings, mapping);
+	add_mapping(current_vmm, mapping);
+	merge_adjacent(current_vmm, mapping);
 
 	return 0;
 
@@ -350,12 +611,13 @@ int vmm_destroy_user_mapping(v_addr_t addr)
 
 	vmm_uaccess_setup();
 
-	return vmm_find_and_destroy_mapping(&current_vmm->mappings, addr);
+	return vmm_find_and_destroy_mapping(current_vmm, addr);
 }
 
 static int vmm_extend_user_mapping(v_addr_t addr, size_t increment)
 {
 	mapping_t* mapping = NULL;
+	mapping_t* next;
 	v_addr_t ext_start;
 	ssize_t diff;
 	int err;
@@ -365,7 +627,7 @@ static int vmm_extend_user_mapping(v_addr_t addr, size_t increment)
 
 	vmm_uaccess_setup();
 
-	mapping = find_mapping(&current_vmm->mappings, addr);
+	mapping = find_mapping(current_vmm, addr);
 	if (!mapping)
 		return -EINVAL;
 
@@ -385,6 +647,18 @@ static int vmm_extend_user_mapping(v_addr_t addr, size_t increment)
 	if (!vmm_range_is_free(ext_start, ext_start + increment - 1))
 		return -EINVAL;
 
+	// grow the region in place: the new pages are backed on first touch
+	if (!(mapping->flags & (VMM_MAP_GROWSDOW | VMM_MAP_POPULATE)) &&
+	    mapping_grow_up(mapping, increment) == 0) {
+		next = next_mapping(current_vmm, mapping);
+		if (next) {
+			update_gap(current_vmm, next);
+			merge_adjacent(current_vmm, mapping);
+		}
+
+		return 0;
+	}
+
 	err = vmm_create_user_mapping(ext_start, increment, mapping->region->prot,
 				      mapping->flags);
 
@@ -400,7 +674,7 @@ void* sys_sbrk(intptr_t increment)
 
 	vmm_uaccess_setup();
 
-	mapping = find_mapping(&current_vmm->mappings, brk);
+	mapping = find_mapping(current_vmm, brk);
 	if (!mapping) {
 		err = vmm_create_user_mapping(brk, increment,
 					      VMM_PROT_USER | VMM_PROT_WRITE, 0);
@@ -417,133 +691,603 @@ void* sys_sbrk(intptr_t increment)
 
 bool vmm_range_is_free(v_addr_t start, v_addr_t end)
 {
-	v_addr_t addr = start;
+	// the last mapping starting before end is the only one that can overlap
+	const mapping_t* m = find_prev_mapping(current_vmm, end);
 
-	while (addr < end) {
-		mapping_t* mapping = find_mapping(&current_vmm->mappings, addr);
-		if (mapping)
-			return false;
+	return (!m || mapping_get_end(m) < start);
+}
 
-		addr += PAGE_SIZE;
-	}
+static bool range_fits(v_addr_t gap_start, v_addr_t gap_end, size_t size,
+		       size_t align, v_addr_t low, v_addr_t* result)
+{
+	const v_addr_t lo = (gap_start > low) ? gap_start : low;
+	const v_addr_t start = align_up(lo, align);
+
+	if (start < lo || start >= gap_end || gap_end - start < size)
+		return false;
+
+	*result = start;
 
 	return true;
 }
 
+/*
+ * In-order search of the subtree for the first gap above low where size
+ * bytes fit. Subtrees without a large enough gap are skipped.
+ */
+static bool find_gap(const rb_node_t* node, size_t size, size_t align,
+		     v_addr_t low, v_addr_t* result)
+{
+	const mapping_t* m;
+
+	if (!node)
+		return false;
+
+	m = rb_entry(node, mapping_t, m_rb);
+	if (m->max_gap < size)
+		return false;
+
+	// gaps of the left subtree and of m end before m->start
+	if (m->start > low) {
+		if (find_gap(node->left, size, align, low, result))
+			return true;
+
+		if (range_fits(m->start - m->gap, m->start, size, align, low,
+			       result))
+			return true;
+	}
+
+	return find_gap(node->right, size, align, low, result);
+}
+
+static bool find_free_range(struct vmm* vmm, size_t size, size_t align,
+			    v_addr_t low, v_addr_t* result)
+{
+	const rb_node_t* last = rb_last(&vmm->mapping_tree);
+	v_addr_t top = USER_SPACE_START;
+
+	if (find_gap(vmm->mapping_tree.node, size, align, low, result))
+		return true;
+
+	// gap above the last mapping
+	if (last) {
+		const mapping_t* m = rb_entry(last, mapping_t, m_rb);
+		top = m->start + m->size;
+	}
+
+	return range_fits(top, USER_SPACE_END, size, align, low, result);
+}
+
+int vmm_find_free_range(size_t size, size_t align, v_addr_t hint,
+			v_addr_t* result)
+{
+	v_addr_t low = (hint > VMM_USER_MIN_ADDR) ? hint : VMM_USER_MIN_ADDR;
+
+	if (align < PAGE_SIZE)
+		align = PAGE_SIZE;
+	if (size == 0 || size > USER_SPACE_SIZE || (align & (align - 1)))
+		return -EINVAL;
+
+	size = page_align_up(size);
+
+	if (find_free_range(current_vmm, size, align, low, result))
+		return 0;
+
+	// nothing above the hint: start over from the bottom
+	if (low > VMM_USER_MIN_ADDR &&
+	    find_free_range(current_vmm, size, align, VMM_USER_MIN_ADDR,
+			    result))
+		return 0;
+
+	return -ENOMEM;
+}
+
 static int update_user_mapping_prot(const mapping_t* mapping, int prot)
 {
 	v_addr_t addr = mapping->start;
 	size_t nr_pages = mapping_size_in_pages(mapping);
+	int err = 0;
 
-	for (size_t i = 0; i < nr_pages; ++i, addr += PAGE_SIZE) {
-		int err = vmm_impl->update_user_page_prot(addr, prot);
-		if (err)
-			return err;
+	vmm_tlb_batch_begin();
+
+	for (size_t i = 0; !err && i < nr_pages; ++i, addr += PAGE_SIZE) {
+		const p_addr_t frame = region_get_frame(mapping->region, i);
+		if (frame)
+			err = vmm_impl->update_user_page_prot(addr,
+							      page_prot(frame,
+									prot));
 	}
 
-	mapping->region->prot = prot;
+	vmm_tlb_batch_end();
 
-	return 0;
+	if (!err)
+		mapping->region->prot = prot;
+
+	return err;
 }
 
 int vmm_update_user_mapping_prot(v_addr_t addr, int prot)
 {
-	const mapping_t* mapping = find_mapping(&current_vmm->mappings, addr);
+	const mapping_t* mapping = find_mapping(current_vmm, addr);
 	if (!mapping)
 		return -ENOENT;
 
 	return update_user_mapping_prot(mapping, prot);
 }
 
-static int copy_mapping_pages(const mapping_t* mapping, region_t* copy)
+/*
+ * Splits the mapping holding addr, if any, so that a mapping starts at addr.
+ */
+static int split_mapping_at(struct vmm* vmm, v_addr_t addr)
 {
-	v_addr_t addr = mapping->start;
-	size_t nr_pages = mapping_size_in_pages(mapping);
+	mapping_t* mapping = find_mapping(vmm, addr);
+	mapping_t* tail;
+	int err;
 
-	if (nr_pages < copy->nr_frames)
-		return -EINVAL;
+	if (!mapping || mapping->start == addr)
+		return 0;
 
-	for (size_t i = 0; i < copy->nr_frames; ++i, addr += PAGE_SIZE) {
-		int err = vmm_impl->copy_page(addr, copy->frames[i]);
-		if (err) {
-			__unmap_mapping(mapping->start, i);
-			return err;
-		}
+	err = mapping_split(mapping, addr, &tail);
+	if (!err)
+		add_mapping(vmm, tail);
+
+	return err;
+}
+
+/*
+ * Returns the first mapping starting at or above addr.
+ */
+static mapping_t* find_mapping_from(struct vmm* vmm, v_addr_t addr)
+{
+	mapping_t* m = find_prev_mapping(vmm, addr);
+
+	if (!m) {
+		const rb_node_t* first = rb_first(&vmm->mapping_tree);
+		return (first) ? rb_entry(first, mapping_t, m_rb) : NULL;
 	}
 
-	return 0;
+	return (m->start == addr) ? m : next_mapping(vmm, m);
+}
+
+/*
+ * Checks that nothing is missing in [start, end[.
+ */
+static bool range_is_mapped(struct vmm* vmm, v_addr_t start, v_addr_t end)
+{
+	mapping_t* mapping = find_mapping(vmm, start);
+
+	while (mapping && mapping->start + mapping->size < end) {
+		mapping_t* next = next_mapping(vmm, mapping);
+
+		if (next && next->start != mapping->start + mapping->size)
+			next = NULL;
+		mapping = next;
+	}
+
+	return (mapping != NULL);
 }
 
-static int reset_user_mapping_prot(const mapping_t* mapping)
+static inline bool valid_user_range(v_addr_t start, v_addr_t end)
 {
-	return update_user_mapping_prot(mapping, mapping->region->prot);
+	return (end > start && page_is_aligned(start) &&
+		range_in_userspace(start, end - start));
 }
 
-static int handle_cow_fault(mapping_t* mapping, int flags)
+int vmm_unmap_user_range(v_addr_t start, size_t size)
 {
-	region_t* copy;
+	const v_addr_t end = start + page_align_up(size);
+	mapping_t* mapping;
 	int err;
 
-	if (region_get_ref(mapping->region) == 1) {
-		return reset_user_mapping_prot(mapping);
+	if (!valid_user_range(start, end))
+		return -EINVAL;
+
+	vmm_uaccess_setup();
+
+	err = split_mapping_at(current_vmm, start);
+	if (!err)
+		err = split_mapping_at(current_vmm, end);
+	if (err)
+		return err;
+
+	// a single flush for the whole range
+	vmm_tlb_batch_begin();
+
+	mapping = find_mapping_from(current_vmm, start);
+	while (!err && mapping && mapping->start < end) {
+		mapping_t* next = next_mapping(current_vmm, mapping);
+
+		remove_mapping(current_vmm, mapping);
+
+		err = vmm_destroy_mapping(mapping);
+		if (err)
+			add_mapping(current_vmm, mapping);
+
+		mapping = next;
 	}
 
-	err = region_create(mapping_size_in_pages(mapping),
-			    mapping->region->prot, &copy);
+	vmm_tlb_batch_end();
+
+	return err;
+}
+
+int vmm_protect_user_range(v_addr_t start, size_t size, int prot)
+{
+	const v_addr_t end = start + page_align_up(size);
+	mapping_t* mapping;
+	int err;
+
+	if (!valid_user_range(start, end))
+		return -EINVAL;
+
+	vmm_uaccess_setup();
+
+	if (!range_is_mapped(current_vmm, start, end))
+		return -ENOMEM;
+
+	for (mapping = find_mapping(current_vmm, start);
+	     mapping && mapping->start < end;
+	     mapping = next_mapping(current_vmm, mapping))
+	{
+		if ((prot & VMM_PROT_WRITE) && (mapping->flags & VMM_MAP_RDONLY))
+			return -EACCES;
+	}
+
+	err = split_mapping_at(current_vmm, start);
+	if (!err)
+		err = split_mapping_at(current_vmm, end);
+
+	vmm_tlb_batch_begin();
+
+	for (mapping = find_mapping(current_vmm, start);
+	     !err && mapping && mapping->start < end;
+	     mapping = next_mapping(current_vmm, mapping))
+		err = update_user_mapping_prot(mapping, prot);
+
+	vmm_tlb_batch_end();
+
+	// undo the splits where the protections match again
+	for (mapping = find_mapping(current_vmm, start);
+	     !err && mapping && mapping->start < end;
+	     mapping = next_mapping(current_vmm, mapping))
+		mapping = merge_adjacent(current_vmm, mapping);
+
+	return err;
+}
+
+/*
+ * Frame holding the page of data at src, with a reference taken for a
+ * mapping (0 if the frame cannot be shared).
+ */
+static p_addr_t get_data_frame(v_addr_t src)
+{
+	p_addr_t frame;
+
+	if (vmm_virt_to_phys(src, &frame) != 0 ||
+	    memory_page_frame_ref(frame) != 0)
+		return 0;
+
+	return frame;
+}
+
+/*
+ * Backs the pages of mapping with the frames holding data, where data lies
+ * on page boundaries. The frames are shared copy-on-write: their owner keeps
+ * its reference.
+ */
+static void share_data_frames(mapping_t* mapping, const void* data,
+			      size_t data_size)
+{
+	// a partial last page would show what follows data
+	const size_t nr_pages = data_size / PAGE_SIZE;
+	v_addr_t src = (v_addr_t)data;
+
+	if (!page_is_aligned(src))
+		return;
+
+	for (size_t i = 0; i < nr_pages; ++i, src += PAGE_SIZE) {
+		const p_addr_t frame = get_data_frame(src);
+		if (frame)
+			region_set_frame(mapping->region, i, frame);
+	}
+}
+
+/*
+ * Builds a region from data, page aligned and covering all of its nr_pages
+ * pages: the frames of data are described by extents, one per physically
+ * contiguous run (a single one for the initrd). Pages that cannot be shared,
+ * like a partial last one, get a zeroed frame to be filled in.
+ */
+static int create_data_region(const void* data, size_t data_size,
+			      size_t nr_pages, int prot, region_t** result)
+{
+	v_addr_t src = (v_addr_t)data;
+	region_t* region;
+	int err;
+
+	err = region_create_extents(prot, &region);
 	if (err)
 		return err;
 
-	err = copy_mapping_pages(mapping, copy);
+	for (size_t i = 0; !err && i < nr_pages; ++i, src += PAGE_SIZE) {
+		p_addr_t frame = 0;
+
+		if ((i + 1) * PAGE_SIZE <= data_size)
+			frame = get_data_frame(src);
+		if (!frame)
+			frame = memory_page_frame_alloc_zeroed();
+
+		if (!frame) {
+			err = -ENOMEM;
+		}
+		else {
+			err = region_append_frames(region, frame, 1);
+			if (err)
+				memory_page_frame_unref(frame);
+		}
+	}
+
 	if (err) {
-		region_unref(copy);
+		region_unref(region);
 		return err;
 	}
 
-	err = unmap_mapping(mapping);
-	if (err) {
-		region_unref(copy);
+	*result = region;
+
+	return 0;
+}
+
+/*
+ * Mapping of size bytes at start for data, its pages backed by the frames of
+ * data where possible.
+ */
+static int create_data_mapping(v_addr_t start, size_t size, int prot,
+			       int flags, const void* data, size_t data_size,
+			       mapping_t** result)
+{
+	const size_t nr_pages = size / PAGE_SIZE;
+	region_t* region;
+	int err;
+
+	// pages past data are populated on first touch
+	if (data_size == 0 || !page_is_aligned((v_addr_t)data) ||
+	    page_align_up(data_size) != size) {
+		err = mapping_create(start, size, prot, flags, result);
+		if (!err)
+			share_data_frames(*result, data, data_size);
+
 		return err;
 	}
 
-	region_unref(mapping->region);
-	mapping->region = copy;
+	err = create_data_region(data, data_size, nr_pages, prot, &region);
+	if (err)
+		return err;
+
+	err = mapping_create_from_region(start, region, flags, result);
+	region_unref(region);
+
+	return err;
+}
+
+int vmm_create_user_file_mapping(v_addr_t start, size_t size, int prot,
+				 int flags, const void* data, size_t data_size)
+{
+	mapping_t* mapping;
+	int err;
+
+	vmm_uaccess_setup();
+
+	size = page_align_up(size);
+	if (!valid_user_range(start, start + size))
+		return -EINVAL;
+
+	if (data_size > size)
+		data_size = size;
+
+	// writable until the pages not shared with data are filled in
+	err = create_data_mapping(start, size,
+				  prot | VMM_PROT_USER | VMM_PROT_WRITE, flags,
+				  data, data_size, &mapping);
+	if (err)
+		return err;
 
 	err = map_mapping(mapping, vmm_impl->map_user_page);
 	if (err) {
-		list_erase(&mapping->m_list);
 		mapping_destroy(mapping);
+		return err;
+	}
+
+	add_mapping(current_vmm, mapping);
+
+	for (size_t off = 0; !err && off < data_size; off += PAGE_SIZE) {
+		const size_t n = (data_size - off < PAGE_SIZE) ?
+			data_size - off : PAGE_SIZE;
+		const p_addr_t frame = region_get_frame(mapping->region,
+							off / PAGE_SIZE);
+
+		// the frames of data hold a reference for their owner
+		if (!frame || memory_page_frame_get_ref(frame) == 1)
+			err = copy_to_user((void*)(start + off),
+					   (const int8_t*)data + off, n);
+	}
+
+	if (!err)
+		err = update_user_mapping_prot(mapping, prot | VMM_PROT_USER);
+
+	if (err) {
+		remove_mapping(current_vmm, mapping);
+		vmm_destroy_mapping(mapping);
 	}
 
 	return err;
 }
 
-v_addr_t vmm_handle_page_fault(v_addr_t fault_addr, int flags)
+/*
+ * Write to a page write-protected since fork: only this page is copied, or
+ * made writable again if no other region references its frame anymore.
+ */
+static int handle_cow_fault(mapping_t* mapping, v_addr_t fault_addr)
 {
+	const v_addr_t page = page_align_down(fault_addr);
+	const size_t index = (page - mapping->start) / PAGE_SIZE;
+	region_t* region = mapping->region;
+	const p_addr_t frame = region_get_frame(region, index);
+	p_addr_t copy;
+	int err;
+
+	if (!frame)
+		return -EFAULT;
+
+	if (memory_page_frame_get_ref(frame) == 1)
+		return vmm_impl->update_user_page_prot(page, region->prot);
+
+	copy = memory_page_frame_alloc();
+	if (!copy)
+		return -ENOMEM;
+
+	err = vmm_impl->copy_page(page, copy);
+	if (err)
+		goto free_copy;
+
+	err = region_set_frame(region, index, copy);
+	if (err)
+		goto free_copy;
+
+	vmm_impl->unmap_user_page(page);
+	memory_page_frame_unref(frame);
+
+	// on failure, the page is mapped again by the not present fault
+	return vmm_impl->map_user_page(copy, page, region->prot);
+
+free_copy:
+	memory_page_frame_free(copy);
+
+	return err;
+}
+
+/*
+ * Maps the faulting page, backing it with a zeroed frame first if it is not
+ * populated yet.
+ */
+static int handle_not_present_fault(mapping_t* mapping, v_addr_t fault_addr)
+{
+	const v_addr_t page = page_align_down(fault_addr);
+	const size_t index = (page - mapping->start) / PAGE_SIZE;
+	p_addr_t frame = region_get_frame(mapping->region, index);
+	bool populated = false;
+	int err;
+
+	if (!frame) {
+		err = region_populate(mapping->region, index, &frame);
+		if (err)
+			return err;
+
+		populated = true;
+	}
+
+	err = vmm_impl->map_user_page(frame, page,
+				      page_prot(frame, mapping->region->prot));
+	if (err && populated)
+		region_depopulate(mapping->region, index);
+
+	return err;
+}
+
+/*
+ * Extends the grows-down mapping stack down to addr, on a fault below it.
+ * The stack at least doubles: the new pages are only backed when touched,
+ * and the region is not reallocated on each fault.
+ */
+static int grow_stack(struct vmm* vmm, mapping_t* stack, v_addr_t addr)
+{
+	const v_addr_t end = stack->start + stack->size;
+	const v_addr_t page = page_align_down(addr);
+	v_addr_t low = prev_mapping_end(vmm, stack) + VMM_STACK_GUARD_GAP;
+	v_addr_t start;
+	int err;
+
+	if (end > VMM_STACK_LIMIT && end - VMM_STACK_LIMIT > low)
+		low = end - VMM_STACK_LIMIT;
+
+	if (page < low || page >= stack->start)
+		return -EFAULT;
+
+	if (stack->start - low > stack->size)
+		start = stack->start - stack->size;
+	else
+		start = low;
+	if (start > page)
+		start = page;
+
+	err = region_grow_down(stack->region, (stack->start - start) / PAGE_SIZE);
+	if (err)
+		return err;
+
+	stack->size += stack->start - start;
+	stack->start = start;
+	update_gap(vmm, stack);
+
+	return 0;
+}
+
+/*
+ * Faults on a user address, from user space or from the kernel (uaccess).
+ */
+static int handle_user_fault(v_addr_t fault_addr, int flags)
+{
+	mapping_t* mapping = find_mapping(current_vmm, fault_addr);
+
+	if (flags & VMM_FAULT_ALIGNMENT)
+		return -EFAULT;
+
+	if (!mapping) {
+		// just below a stack?
+		mapping = find_mapping_from(current_vmm, fault_addr);
+		if (!mapping || !(mapping->flags & VMM_MAP_GROWSDOW) ||
+		    grow_stack(current_vmm, mapping, fault_addr) != 0)
+			return -EFAULT;
+	}
+
+	// PROT_NONE
+	if ((flags & VMM_FAULT_USER) &&
+	    !(mapping->region->prot & VMM_PROT_USER))
+		return -EFAULT;
+
+	if ((flags & VMM_FAULT_WRITE) &&
+	    !(mapping->region->prot & VMM_PROT_WRITE))
+		return -EFAULT;
+
+	if (flags & VMM_FAULT_NOT_PRESENT)
+		return handle_not_present_fault(mapping, fault_addr);
+
+	if (flags & VMM_FAULT_WRITE)
+		return handle_cow_fault(mapping, fault_addr);
+
+	return -EFAULT;
+}
+
+v_addr_t vmm_handle_page_fault(v_addr_t fault_addr, v_addr_t fault_insn,
+			       int flags)
+{
+	v_addr_t fixup;
+
 	log_w_printf("#PF: %p (flags=%p)\n", (void*)fault_addr,
 		     (void*)(v_addr_t)flags);
 
+	if (vmm_is_userspace_address(fault_addr) &&
+	    handle_user_fault(fault_addr, flags) == 0)
+		return 0;
+
 	if (flags & VMM_FAULT_USER) {
-		mapping_t* mapping = find_mapping(&current_vmm->mappings, fault_addr);
-
-		if (mapping &&
-		    (flags & VMM_FAULT_WRITE) &&
-		    (mapping->region->prot & VMM_PROT_WRITE) &&
-		    !(flags & VMM_FAULT_ALIGNMENT))
-		{
-			kassert(handle_cow_fault(mapping, flags) == 0);
-		}
-		else {
-			process_kill(sched_get_current_process()->pid, SIGSEGV);
-			sched_yield();
-			return fault_addr;
-		}
+		process_kill(sched_get_current_process()->pid, SIGSEGV);
+		sched_yield();
+		return fault_addr;
 	}
 	else {
-		if (__fixup_addr) {
-			v_addr_t ret = __fixup_addr;
-			__fixup_addr = 0;
-			return ret;
-		}
+		// a uaccess primitive touched a bad user address
+		fixup = extable_search(fault_insn);
+		if (fixup)
+			return fixup;
 
 		PANIC("kernel page fault");
 	}
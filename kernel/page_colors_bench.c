@@ -0,0 +1,148 @@
+#include <config.h>
+#include <kernel/cpu.h>
+#include <kernel/kmalloc.h>
+#include <kernel/mm/memory.h>
+#include <kernel/mm/vmalloc.h>
+#include <kernel/mm/vmm.h>
+#include <kernel/page_colors_bench.h>
+#include <kernel/terminal.h>
+#include <kernel/types.h>
+#include <libk/utils.h>
+
+#define BENCH_CACHE_LINE	64
+#define BENCH_WALKS		16
+
+// frames freed in a random order first, as on a system that has been running
+#define BENCH_SCRAMBLE_FRAMES	512
+
+static const size_t bench_nr_pages[] = { 8, 16, 32, 64, 128 };
+
+// keeps the loads from being optimized out
+static volatile uint32_t bench_sink;
+
+static uint32_t bench_random(void)
+{
+	static uint32_t seed = 1;
+
+	seed = seed * 1103515245 + 12345;
+
+	return (seed >> 8);
+}
+
+/*
+ * Allocates frames, then frees them in a random order: the free lists no
+ * longer hand out physically consecutive frames.
+ */
+static void scramble_free_frames(void)
+{
+	p_addr_t* frames;
+	size_t n;
+
+	frames = kmalloc(BENCH_SCRAMBLE_FRAMES * sizeof(p_addr_t));
+	if (!frames)
+		return;
+
+	for (n = 0; n < BENCH_SCRAMBLE_FRAMES; ++n) {
+		frames[n] = memory_page_frame_alloc();
+		if (!frames[n])
+			break;
+	}
+
+	for (size_t i = n; i > 1; --i) {
+		const size_t j = bench_random() % i;
+		const p_addr_t tmp = frames[i - 1];
+
+		frames[i - 1] = frames[j];
+		frames[j] = tmp;
+	}
+
+	for (size_t i = 0; i < n; ++i)
+		memory_page_frame_free(frames[i]);
+
+	kfree(frames);
+}
+
+/*
+ * Buffer backed by frames allocated the way the pages of a new process are:
+ * round-robin over the colors from a vmm cursor when coloring is on.
+ */
+static uint8_t* alloc_buffer(size_t nr_pages)
+{
+	uint8_t* buffer;
+#ifdef MEMORY_PAGE_COLORS
+	struct vmm* vmm = vmm_get_current_vmm();
+	unsigned int cursor = 0;
+
+	memory_set_color_cursor(&cursor);
+#endif
+
+	buffer = vmalloc(nr_pages * PAGE_SIZE);
+
+#ifdef MEMORY_PAGE_COLORS
+	memory_set_color_cursor((vmm) ? &vmm->color : NULL);
+#endif
+
+	return buffer;
+}
+
+/*
+ * Reads the same line of every page before moving to the next line: the
+ * pages whose frames share a color compete for the same cache sets.
+ */
+static uint32_t walk(const uint8_t* buffer, size_t nr_pages)
+{
+	uint32_t sum = 0;
+
+	for (size_t w = 0; w < BENCH_WALKS; ++w) {
+		for (size_t off = 0; off < PAGE_SIZE; off += BENCH_CACHE_LINE) {
+			for (size_t p = 0; p < nr_pages; ++p)
+				sum += buffer[p * PAGE_SIZE + off];
+		}
+	}
+
+	return sum;
+}
+
+static void bench_run(size_t nr_pages)
+{
+	const size_t accesses =
+		BENCH_WALKS * nr_pages * (PAGE_SIZE / BENCH_CACHE_LINE);
+	uint8_t* buffer = alloc_buffer(nr_pages);
+
+	if (!buffer) {
+		terminal_printf("%u pages\tno memory\n", (unsigned int)nr_pages);
+		return;
+	}
+
+	// warm up the caches and the TLB
+	bench_sink = walk(buffer, nr_pages);
+
+	uint32_t start = cpu_cycles();
+	bench_sink = walk(buffer, nr_pages);
+	uint32_t cycles = cpu_cycles() - start;
+
+	// cycles per access, 2 decimal places
+	uint32_t rate = (cycles / accesses) * 100 +
+		((cycles % accesses) * 100) / accesses;
+
+	terminal_printf("%u pages\t%u.%u%u cycles/access\n",
+			(unsigned int)nr_pages, rate / 100, (rate / 10) % 10,
+			rate % 10);
+
+	vfree(buffer);
+}
+
+void page_colors_bench(void)
+{
+#ifdef MEMORY_PAGE_COLORS
+	terminal_printf("page colors benchmark: %d colors\n",
+			MEMORY_PAGE_COLORS);
+#else
+	terminal_puts("page colors benchmark: coloring off\n");
+#endif
+
+	scramble_free_frames();
+
+	for (size_t i = 0; i < ARRAY_SIZE(bench_nr_pages); ++i)
+		bench_run(bench_nr_pages[i]);
+}
@@ -3,6 +3,7 @@
 #include <kernel/interrupt.h>
 #include <kernel/kassert.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <kernel/process.h>
 #include <kernel/sched/sched.h>
 #include <libk/libk.h>
@@ -13,6 +14,14 @@
 #define PROCESS_TABLE_SIZE 64
 static struct process* process_table[PROCESS_TABLE_SIZE + 1] = { NULL, };
 
+static struct kmem_cache* process_cache;
+
+int process_cache_init(void)
+{
+	return kmem_cache_create("process", sizeof(struct process), NULL,
+				 &process_cache);
+}
+
 
 static pid_t find_free_pid(void)
 {
@@ -85,13 +94,13 @@ int process_create(const char* name, struct process** result)
 	struct process* proc;
 	int err;
 
-	proc = kmalloc(sizeof(struct process));
+	proc = kmem_cache_alloc(process_cache);
 	if (!proc)
 		return -ENOMEM;
 
 	err = process_init(proc, name);
 	if (err) {
-		kfree(proc);
+		kmem_cache_free(process_cache, proc);
 		proc = NULL;
 	}
 
@@ -424,7 +433,7 @@ static void process_reset(struct process* proc)
 void process_destroy(struct process* proc)
 {
 	process_reset(proc);
-	kfree(proc);
+	kmem_cache_free(process_cache, proc);
 }
 
 void process_exec(struct process* proc)
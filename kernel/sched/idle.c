@@ -1,12 +1,16 @@
 #include <kernel/kassert.h>
 #include <kernel/kthread.h>
+#include <kernel/mm/memory.h>
 #include <kernel/sched/idle.h>
 #include <kernel/sched/sched.h>
 
 static void idle_kthread_do(void* data)
 {
-	while (1)
+	while (1) {
+		// a few frames at a time, to yield the CPU quickly
+		memory_zeroed_pool_refill(4);
 		sched_yield();
+	}
 }
 
 void idle_init(void)
@@ -2,6 +2,7 @@
 #include <dummyos/syscall.h>
 #include <kernel/types.h>
 #include <dummyos/stat.h>
+#include <dummyos/mman.h>
 
 static int nosys(void);
 void sys_exit(int);
@@ -38,6 +39,9 @@ int sys_stat(const char* __user path, struct stat* __user sb);
 int sys_fstat(int fd, struct stat* __user sb);
 int sys_nanosleep(const struct timespec* __user timeout,
 		  struct timespec* __user remainder);
+void* sys_mmap(const struct mmap_args* __user args);
+int sys_munmap(void* __user addr, size_t length);
+int sys_mprotect(void* __user addr, size_t length, int prot);
 
 #define __syscall(s) ((v_addr_t)s)
 
@@ -74,6 +78,9 @@ v_addr_t syscall_table[_SYSCALL_NR_COUNT] = {
 	[SYS_stat]		= __syscall(sys_stat),
 	[SYS_fstat]		= __syscall(sys_fstat),
 	[SYS_nanosleep]		= __syscall(sys_nanosleep),
+	[SYS_mmap]		= __syscall(sys_mmap),
+	[SYS_munmap]		= __syscall(sys_munmap),
+	[SYS_mprotect]		= __syscall(sys_mprotect),
 };
 
 static int nosys(void)
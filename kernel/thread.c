@@ -3,6 +3,7 @@
 #include <kernel/interrupt.h>
 #include <kernel/kassert.h>
 #include <kernel/kmalloc.h>
+#include <kernel/kmem_cache.h>
 #include <kernel/sched/reaper.h>
 #include <kernel/sched/sched.h>
 #include <kernel/thread.h>
@@ -10,6 +11,14 @@
 
 #include <kernel/log.h>
 
+static struct kmem_cache* thread_cache;
+
+int thread_cache_init(void)
+{
+	return kmem_cache_create("thread", sizeof(struct thread), NULL,
+				 &thread_cache);
+}
+
 static int create_kstack(struct stack* kstack, size_t size)
 {
 	void* sp = kmalloc(size);
@@ -41,7 +50,7 @@ void __thread_destroy(struct thread* thread)
 	log_printf("#### %s(): %s (%p) state=%d\n", __func__, thread->name,
 		   (void*)thread, thread->state);
 	thread_reset(thread);
-	kfree(thread);
+	kmem_cache_free(thread_cache, thread);
 }
 
 static int init(struct thread* thread, char* name, size_t kstack_size,
@@ -74,13 +83,13 @@ static int __thread_create(char* name, size_t kstack_size,
 {
 	int err;
 
-	struct thread* thread = kmalloc(sizeof(struct thread));
+	struct thread* thread = kmem_cache_alloc(thread_cache);
 	if (!thread)
 		return -ENOMEM;
 
 	err = init(thread, name, kstack_size, type, SCHED_PRIORITY_LEVEL_DEFAULT);
 	if (err) {
-		kfree(thread);
+		kmem_cache_free(thread_cache, thread);
 		thread = NULL;
 	}
 
@@ -139,13 +148,13 @@ int thread_clone(const struct thread* thread, char* name,
 {
 	int err;
 
-	struct thread* new = kmalloc(sizeof(struct thread));
+	struct thread* new = kmem_cache_alloc(thread_cache);
 	if (!new)
 		return -ENOMEM;
 
 	err = clone(thread, name, new);
 	if (err) {
-		kfree(new);
+		kmem_cache_free(thread_cache, new);
 		new = NULL;
 	}
 
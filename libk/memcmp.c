@@ -1,9 +1,27 @@
 #include <libk/libk.h>
 
+#include "word.h"
+
 int memcmp(const void* s1, const void* s2, size_t size)
 {
 	const unsigned char* s01 = s1;
 	const unsigned char* s02 = s2;
+
+	// skip the equal words when both are equally aligned
+	if ((((uintptr_t)s01 ^ (uintptr_t)s02) & WORD_MASK) == 0) {
+		while (size > 0 && !word_aligned(s01) && *s01 == *s02) {
+			++s01;
+			++s02;
+			--size;
+		}
+		while (size >= WORD_SIZE &&
+		       *(const word_t*)s01 == *(const word_t*)s02) {
+			s01 += WORD_SIZE;
+			s02 += WORD_SIZE;
+			size -= WORD_SIZE;
+		}
+	}
+
 	while (size > 0 && *s01 == *s02) {
 		++s01;
 		++s02;
@@ -0,0 +1,17 @@
+#include <libk/libk.h>
+
+void* memmove(void* dest, const void* src, size_t size)
+{
+	// forward unless dest overlaps the end of src
+	if ((uintptr_t)dest - (uintptr_t)src >= size)
+		return memcpy(dest, src, size);
+
+	char* dst = dest;
+	const char* s = src;
+	while (size > 0) {
+		--size;
+		dst[size] = s[size];
+	}
+
+	return dest;
+}
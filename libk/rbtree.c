@@ -0,0 +1,312 @@
+#include <libk/rbtree.h>
+
+static inline bool is_red(const rb_node_t* node)
+{
+	return (node && node->red);
+}
+
+static void replace_child(rb_node_t* parent, rb_node_t* old, rb_node_t* new,
+			  rb_root_t* root)
+{
+	if (!parent)
+		root->node = new;
+	else if (parent->left == old)
+		parent->left = new;
+	else
+		parent->right = new;
+}
+
+static void rotate_left(rb_node_t* x, rb_root_t* root, rb_augment_t update)
+{
+	rb_node_t* y = x->right;
+
+	x->right = y->left;
+	if (y->left)
+		y->left->parent = x;
+
+	y->parent = x->parent;
+	replace_child(x->parent, x, y, root);
+
+	y->left = x;
+	x->parent = y;
+
+	// x is now below y
+	if (update) {
+		update(x);
+		update(y);
+	}
+}
+
+static void rotate_right(rb_node_t* x, rb_root_t* root, rb_augment_t update)
+{
+	rb_node_t* y = x->left;
+
+	x->left = y->right;
+	if (y->right)
+		y->right->parent = x;
+
+	y->parent = x->parent;
+	replace_child(x->parent, x, y, root);
+
+	y->right = x;
+	x->parent = y;
+
+	if (update) {
+		update(x);
+		update(y);
+	}
+}
+
+void rb_propagate(rb_node_t* node, rb_augment_t update)
+{
+	for (; node; node = node->parent)
+		update(node);
+}
+
+static void insert_color(rb_node_t* node, rb_root_t* root,
+			 rb_augment_t update)
+{
+	rb_node_t* parent;
+
+	while ((parent = node->parent) && parent->red) {
+		rb_node_t* gparent = parent->parent;
+
+		if (parent == gparent->left) {
+			rb_node_t* uncle = gparent->right;
+
+			if (is_red(uncle)) {
+				parent->red = false;
+				uncle->red = false;
+				gparent->red = true;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->right) {
+				rotate_left(parent, root, update);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->red = false;
+			gparent->red = true;
+			rotate_right(gparent, root, update);
+		}
+		else {
+			rb_node_t* uncle = gparent->left;
+
+			if (is_red(uncle)) {
+				parent->red = false;
+				uncle->red = false;
+				gparent->red = true;
+				node = gparent;
+				continue;
+			}
+
+			if (node == parent->left) {
+				rotate_right(parent, root, update);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->red = false;
+			gparent->red = true;
+			rotate_left(gparent, root, update);
+		}
+	}
+
+	root->node->red = false;
+}
+
+void rb_insert_color(rb_node_t* node, rb_root_t* root)
+{
+	insert_color(node, root, NULL);
+}
+
+void rb_insert_augmented(rb_node_t* node, rb_root_t* root, rb_augment_t update)
+{
+	rb_propagate(node, update);
+	insert_color(node, root, update);
+}
+
+static void transplant(rb_node_t* old, rb_node_t* new, rb_root_t* root)
+{
+	replace_child(old->parent, old, new, root);
+	if (new)
+		new->parent = old->parent;
+}
+
+static rb_node_t* leftmost(rb_node_t* node)
+{
+	while (node->left)
+		node = node->left;
+
+	return node;
+}
+
+static rb_node_t* rightmost(rb_node_t* node)
+{
+	while (node->right)
+		node = node->right;
+
+	return node;
+}
+
+/*
+ * node (possibly NULL) child of parent, replaced a black node
+ */
+static void erase_color(rb_node_t* node, rb_node_t* parent, rb_root_t* root,
+			rb_augment_t update)
+{
+	while (node != root->node && !is_red(node)) {
+		if (node == parent->left) {
+			rb_node_t* sibling = parent->right;
+
+			if (is_red(sibling)) {
+				sibling->red = false;
+				parent->red = true;
+				rotate_left(parent, root, update);
+				sibling = parent->right;
+			}
+
+			if (!is_red(sibling->left) && !is_red(sibling->right)) {
+				sibling->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if (!is_red(sibling->right)) {
+				sibling->left->red = false;
+				sibling->red = true;
+				rotate_right(sibling, root, update);
+				sibling = parent->right;
+			}
+
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->right->red = false;
+			rotate_left(parent, root, update);
+			node = root->node;
+		}
+		else {
+			rb_node_t* sibling = parent->left;
+
+			if (is_red(sibling)) {
+				sibling->red = false;
+				parent->red = true;
+				rotate_right(parent, root, update);
+				sibling = parent->left;
+			}
+
+			if (!is_red(sibling->left) && !is_red(sibling->right)) {
+				sibling->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if (!is_red(sibling->left)) {
+				sibling->right->red = false;
+				sibling->red = true;
+				rotate_left(sibling, root, update);
+				sibling = parent->left;
+			}
+
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->left->red = false;
+			rotate_right(parent, root, update);
+			node = root->node;
+		}
+	}
+
+	if (node)
+		node->red = false;
+}
+
+static void erase(rb_node_t* node, rb_root_t* root, rb_augment_t update)
+{
+	rb_node_t* child;
+	rb_node_t* parent;
+	bool removed_red;
+
+	if (!node->left || !node->right) {
+		child = (node->left) ? node->left : node->right;
+		parent = node->parent;
+		removed_red = node->red;
+
+		transplant(node, child, root);
+	}
+	else {
+		// replace node with its successor
+		rb_node_t* next = leftmost(node->right);
+
+		child = next->right;
+		removed_red = next->red;
+
+		if (next->parent == node) {
+			parent = next;
+		}
+		else {
+			parent = next->parent;
+			transplant(next, next->right, root);
+			next->right = node->right;
+			next->right->parent = next;
+		}
+
+		transplant(node, next, root);
+		next->left = node->left;
+		next->left->parent = next;
+		next->red = node->red;
+	}
+
+	// the subtrees changed from parent up
+	if (update)
+		rb_propagate(parent, update);
+
+	if (!removed_red)
+		erase_color(child, parent, root, update);
+}
+
+void rb_erase(rb_node_t* node, rb_root_t* root)
+{
+	erase(node, root, NULL);
+}
+
+void rb_erase_augmented(rb_node_t* node, rb_root_t* root, rb_augment_t update)
+{
+	erase(node, root, update);
+}
+
+rb_node_t* rb_first(const rb_root_t* root)
+{
+	return (root->node) ? leftmost(root->node) : NULL;
+}
+
+rb_node_t* rb_last(const rb_root_t* root)
+{
+	return (root->node) ? rightmost(root->node) : NULL;
+}
+
+rb_node_t* rb_next(const rb_node_t* node)
+{
+	if (node->right)
+		return leftmost(node->right);
+
+	while (node->parent && node == node->parent->right)
+		node = node->parent;
+
+	return node->parent;
+}
+
+rb_node_t* rb_prev(const rb_node_t* node)
+{
+	if (node->left)
+		return rightmost(node->left);
+
+	while (node->parent && node == node->parent->left)
+		node = node->parent;
+
+	return node->parent;
+}
@@ -1,8 +1,22 @@
 #include <libk/libk.h>
 
+#include "word.h"
+
 size_t strlen(const char* str)
 {
 	const char* s = str;
+	while (!word_aligned(s)) {
+		if (!*s)
+			return (s - str);
+		++s;
+	}
+
+	/*
+	 * An aligned word never crosses a page boundary, so reading past the
+	 * terminating byte within the last word is safe.
+	 */
+	while (!word_has_zero(*(const word_t*)s))
+		s += WORD_SIZE;
 	while (*s)
 		++s;
 
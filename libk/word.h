@@ -0,0 +1,28 @@
+#ifndef _LIBK_WORD_H_
+#define _LIBK_WORD_H_
+
+#include <kernel/types.h>
+
+/*
+ * word-at-a-time helpers for the generic string functions
+ */
+
+typedef unsigned long __attribute__((__may_alias__)) word_t;
+
+#define WORD_SIZE	sizeof(word_t)
+#define WORD_MASK	(WORD_SIZE - 1)
+
+#define WORD_ONES	((word_t)-1 / 0xff)
+#define WORD_HIGHS	(WORD_ONES * 0x80)
+
+static inline bool word_aligned(const void* p)
+{
+	return (((uintptr_t)p & WORD_MASK) == 0);
+}
+
+static inline bool word_has_zero(word_t w)
+{
+	return (((w - WORD_ONES) & ~w & WORD_HIGHS) != 0);
+}
+
+#endif